@@ -38,7 +38,7 @@ def compile_wasm():
         "-s", "ASYNCIFY=1",  # Important for blocking calls
         "-s", "SUPPORT_LONGJMP=emscripten",  # Enable setjmp/longjmp support (JS-based, compatible with ASYNCIFY)
         "-s", "FORCE_FILESYSTEM=1",  # Enable virtual filesystem
-        "-s", "EXPORTED_FUNCTIONS=['_main','_mdep_on_midi_message','_mdep_on_mouse_move','_mdep_on_mouse_button','_mdep_on_key_event','_mdep_on_window_resize','_mdep_on_nats_message','_mdep_on_websocket_event']",
+        "-s", "EXPORTED_FUNCTIONS=['_main','_mdep_on_midi_message','_mdep_on_midi_sysex','_mdep_on_mouse_move','_mdep_on_mouse_button','_mdep_on_key_event','_mdep_on_window_resize','_mdep_on_nats_message','_mdep_on_websocket_event']",
         "-s", "EXPORTED_RUNTIME_METHODS=['ccall','cwrap','getValue','setValue','UTF8ToString','FS','IDBFS','HEAPU8']",
         "-lidbfs.js",  # Include IDBFS library
         "-s", "ASSERTIONS=1",  # Enable runtime assertions
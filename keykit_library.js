@@ -353,12 +353,21 @@ mergeInto(LibraryManager.library, {
             //            ' - Status: 0x' + status.toString(16).padStart(2, '0') +
             //            ', Data1: ' + data1 + ', Data2: ' + data2);
 
+            // How long ago the message arrived, in milliseconds
+            var age = Math.max(0, Math.round(performance.now() - event.timeStamp));
+
             // Call back into C code with MIDI data
             if (typeof Module !== 'undefined' && Module.ccall) {
                 try {
-                    Module.ccall('mdep_on_midi_message', null,
-                                 ['number', 'number', 'number', 'number'],
-                                 [index, status, data1, data2]);
+                    if (data.length > 3) {
+                        Module.ccall('mdep_on_midi_sysex', null,
+                                     ['number', 'array', 'number', 'number'],
+                                     [index, data, data.length, age]);
+                    } else {
+                        Module.ccall('mdep_on_midi_message', null,
+                                     ['number', 'number', 'number', 'number', 'number', 'number'],
+                                     [index, status, data1, data2, data.length, age]);
+                    }
                     // console.log('[MIDI IN] Successfully called C callback');
                 } catch (e) {
                     console.error('[MIDI IN] Error calling C callback:', e);
@@ -384,7 +393,8 @@ mergeInto(LibraryManager.library, {
     },
 
     // Send MIDI message to output device
-    js_send_midi_output: function (index, data_ptr, data_len) {
+    // If delay is > 0, the data is sent that many milliseconds from now.
+    js_send_midi_output: function (index, data_ptr, data_len, delay) {
         if (!window.midiOutputs || index < 0 || index >= window.midiOutputs.length) {
             console.error('Invalid MIDI output index: ' + index);
             return -1;
@@ -399,7 +409,11 @@ mergeInto(LibraryManager.library, {
         }
 
         try {
-            output.send(data);
+            if (delay > 0) {
+                output.send(data, performance.now() + delay);
+            } else {
+                output.send(data);
+            }
             return 0; // Success
         } catch (err) {
             console.error('Error sending MIDI data:', err);
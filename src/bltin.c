@@ -67,45 +67,18 @@ Datum
 limitsarr(Phrasep ph)
 {
 	Datum da;
-	Noteptr n;
-	int maxpitch = -1;
-	int minpitch = 128;
-	long mintime = MAXCLICKS;
-	long maxtime = -MAXCLICKS;
-	long tm1, tm2;
+	Phstats *st;
 
 	da = newarrdatum(0,5);
 
-	n = firstnote(ph);
-	if ( n == NULL )
+	if ( firstnote(ph) == NULL )
 		return da;
 
-	for ( ; n!=NULL; n=nextnote(n) ) {
-		if ( ntisnote(n) ) {
-			if ( (int)pitchof(n) > maxpitch )
-				maxpitch = pitchof(n);
-			if ( (int)pitchof(n) < minpitch )
-				minpitch = pitchof(n);
-		}
-		else {
-			int y1, y2;
-			nonnotesize(n,&y1,&y2);
-			if ( y2 > maxpitch )
-				maxpitch = y2;
-			if ( y1 < minpitch )
-				minpitch = y1;
-		}
-		tm1 = timeof(n);
-		if ( tm1 < mintime )
-			mintime = tm1;
-		tm2 = endof(n);
-		if ( tm2 > maxtime )
-			maxtime = tm2;
-	}
-	setarraydata(da.u.arr,Str_earliest,numdatum(mintime));
-	setarraydata(da.u.arr,Str_latest,numdatum(maxtime));
-	setarraydata(da.u.arr,Str_lowest,numdatum(minpitch));
-	setarraydata(da.u.arr,Str_highest,numdatum(maxpitch));
+	st = phstats(ph);
+	setarraydata(da.u.arr,Str_earliest,numdatum(st->earliest));
+	setarraydata(da.u.arr,Str_latest,numdatum(st->latest));
+	setarraydata(da.u.arr,Str_lowest,numdatum(st->lowest));
+	setarraydata(da.u.arr,Str_highest,numdatum(st->highest));
 	return da;
 }
 
@@ -164,6 +137,77 @@ bi_phdump(int argc)
 	ret(Nullval);
 }
 
+/*
+ * phrasestats() returns the number of notes in use and allocated, how
+ * many notes and phrases have been made, and how often a phrase about
+ * to be changed could be changed in place, or had to be copied (and how
+ * many notes were copied) because something else was using it.
+ * phrasestats("reset") zeroes all but the first two.
+ */
+void
+bi_phrasestats(int argc)
+{
+	Datum d;
+
+	if ( argc > 0 && strcmp(needstr("phrasestats",ARG(0)),"reset")==0 ) {
+		Cowcopies = 0;
+		Cownotes = 0;
+		Cowinplace = 0;
+		Newnotes = 0;
+		Newphrases = 0;
+		Messallocs = 0;
+		Reclaimed = 0;
+		Reclaimmax = 0;
+		d = Nullval;
+	}
+	else {
+		d = newarrdatum(0,3);
+		setarraydata(d.u.arr,strdatum(uniqstr("notes")),numdatum((long)Numnotes));
+		setarraydata(d.u.arr,strdatum(uniqstr("allocated")),numdatum((long)Numalloc));
+		setarraydata(d.u.arr,strdatum(uniqstr("notesize")),numdatum((long)sizeof(Notedata)));
+		setarraydata(d.u.arr,strdatum(uniqstr("messages")),numdatum(Nmessages));
+		setarraydata(d.u.arr,strdatum(uniqstr("messallocs")),numdatum(Messallocs));
+		setarraydata(d.u.arr,strdatum(uniqstr("reclaimed")),numdatum(Reclaimed));
+		setarraydata(d.u.arr,strdatum(uniqstr("maxpause")),numdatum(Reclaimmax));
+#ifdef NTATTRIB
+		setarraydata(d.u.arr,strdatum(uniqstr("attribs")),numdatum(Nattribs));
+#endif
+		setarraydata(d.u.arr,strdatum(uniqstr("newnotes")),numdatum(Newnotes));
+		setarraydata(d.u.arr,strdatum(uniqstr("newphrases")),numdatum(Newphrases));
+		setarraydata(d.u.arr,strdatum(uniqstr("inplace")),numdatum(Cowinplace));
+		setarraydata(d.u.arr,strdatum(uniqstr("copied")),numdatum(Cowcopies));
+		setarraydata(d.u.arr,strdatum(uniqstr("copiednotes")),numdatum(Cownotes));
+	}
+	ret(d);
+}
+
+/*
+ * stringstats() returns the number of unique strings (see uniqstr())
+ * and the bytes they take up, the number of hash chains they're in,
+ * how many of those are used and the longest one, and how many of the
+ * strings can be reclaimed, and have been reclaimed by how many sweeps.
+ */
+void
+bi_stringstats(int argc)
+{
+	Datum d;
+	long nchains, nused, maxchain;
+
+	if ( argc != 0 )
+		execerror("usage: stringstats()");
+	strchains(&nchains,&nused,&maxchain);
+	d = newarrdatum(0,3);
+	setarraydata(d.u.arr,strdatum(uniqstr("strings")),numdatum(Nstrings));
+	setarraydata(d.u.arr,strdatum(uniqstr("bytes")),numdatum(Strbytes));
+	setarraydata(d.u.arr,strdatum(uniqstr("chains")),numdatum(nchains));
+	setarraydata(d.u.arr,strdatum(uniqstr("usedchains")),numdatum(nused));
+	setarraydata(d.u.arr,strdatum(uniqstr("maxchain")),numdatum(maxchain));
+	setarraydata(d.u.arr,strdatum(uniqstr("reclaimable")),numdatum(Ntmpstrings));
+	setarraydata(d.u.arr,strdatum(uniqstr("reclaimed")),numdatum(Strswept));
+	setarraydata(d.u.arr,strdatum(uniqstr("sweeps")),numdatum(Nstrsweeps));
+	ret(d);
+}
+
 static Datum Listarr;
 
 int
@@ -179,9 +223,8 @@ bi_taskinfo(int argc)
 {
 	Datum retval;
 	Datum *dp;
-	Sched *sch;
 	char *type;
-	long tid;
+	long tid, clk;
 	Ktaskp t;
 	char *s = "taskinfo";
 	static int first = 1;
@@ -287,22 +330,14 @@ bi_taskinfo(int argc)
 		retval = numdatum(t->cnt);
 	else if ( strcmp(type,"schedtime")==0 ) {
 		if ( t->state == T_SLEEPTILL || t->state == T_SCHED ) {
-			for ( sch=Topsched; sch!=NULL; sch=sch->next ) {
-				if ( sch->task == t ) {
-					retval = numdatum(sch->clicks);
-					break;
-				}
-			}
+			if ( taskschedtime(t,&clk) )
+				retval = numdatum(clk);
 		}
 	}
 	else if ( strcmp(type,"schedcount")==0 ) {
 		if ( t->state == T_SLEEPTILL || t->state == T_SCHED ) {
-			for ( sch=Topsched; sch!=NULL; sch=sch->next ) {
-				if ( sch->task == t && t->schedcnt > 1 ) {
-					retval = numdatum(t->schedcnt);
-					break;
-				}
-			}
+			if ( taskschedtime(t,&clk) && t->schedcnt > 1 )
+				retval = numdatum(t->schedcnt);
 		}
 	}
 	else if ( strcmp(type,"wait")==0 ) {
@@ -775,6 +810,289 @@ bi_cut(int argc)
 	ret(d);
 }
 
+/*
+ * The phrase transforms below (transpose, quantize, etc.) used to be
+ * written in keykit code in lib/basic1.k, where they are still available
+ * as oldtranspose, oldquantize, etc.  They produce exactly the same
+ * results, but in a single pass, without making a phrase for each note.
+ */
+
+/* the value of nt.dur in keykit code, when nt is a single note */
+#define xformdur(n) (ntisbytes(n)?0L:durof(n))
+
+/* Like the keykit versions, a bad call prints the usage and gives ''. */
+/* It goes where print() in util1.k would put it: the Console (by way */
+/* of Consoutfifo and consoutloop()) if there is one, otherwise where */
+/* printf() puts it. */
+static void
+xformusage(char *usage)
+{
+	Symbolp s = findsym(uniqstr("Console"),Topct->symbols);
+
+	if ( *Graphics && s != NULL && ! isundefd(s) ) {
+		tprint("%s",usage);
+		tprint("\n");
+		tsync();
+	}
+	else {
+		mdep_popup(usage);
+		mdep_popup("\n");
+	}
+	ret(phrdatum(newph(0)));
+}
+
+static void
+xformdot(char *name,int argc,int dottype,int op)
+{
+	Phrasep ph;
+	Noteptr nt;
+	Datum d;
+
+	if ( argc < 2 )
+		execerror("%s: no value given for its second argument",name);
+	ph = needphr(name,ARG(0));
+	d = phrdatum(newph(1));
+	phcopy(d.u.phr,ph);
+	for ( nt=firstnote(d.u.phr); nt!=NULL; nt=nextnote(nt) ) {
+		chkrealoften();
+		(void) ntassign(nt,dottype,ARG(1),op);
+	}
+	phreorder(d.u.phr);
+	phdecruse(d.u.phr);	/* to reverse initial (1) */
+	ret(d);
+}
+
+void
+bi_transpose(int argc)
+{
+	if ( argc != 2 ) {
+		xformusage("usage: transpose(phrase,amount)");
+		return;
+	}
+	xformdot("transpose",argc,PITCH,'+');
+}
+
+void
+bi_scavol(int argc)
+{
+	if ( argc == 0 ) {
+		xformusage("usage: scavol(phrase,factor)");
+		return;
+	}
+	xformdot("scavol",argc,VOL,'*');
+}
+
+void
+bi_scadur(int argc)
+{
+	if ( argc == 0 ) {
+		xformusage("usage: scadur(phrase,factor)");
+		return;
+	}
+	xformdot("scadur",argc,DUR,'*');
+}
+
+/* The length of a phrase built with "r |= nt" for each nt in ph */
+static long
+xformleng(Phrasep ph)
+{
+	Noteptr nt;
+	long leng = 0;
+
+	for ( nt=firstnote(ph); nt!=NULL; nt=nextnote(nt) ) {
+		if ( endof(nt) > leng )
+			leng = endof(nt);
+	}
+	return leng;
+}
+
+static long
+numquant(long v,long q)
+{
+	long rem;
+
+	if ( q == 0 )
+		execerror("modulo operator doesn't work on 0!");
+	if ( v < 0 ) {
+		rem = -v % q;
+		if ( (rem*2) > q )
+			v -= (q-rem);
+		else
+			v += rem;
+	}
+	else {
+		rem = v % q;
+		if ( (rem*2) > q )
+			v += (q-rem);
+		else
+			v -= rem;
+	}
+	return v;
+}
+
+void
+bi_quantize(int argc)
+{
+	Phrasep ph;
+	Noteptr nt, n;
+	long qnt, lim, rem, delta;
+	Datum d;
+
+	if ( argc < 2 ) {
+		xformusage("usage: quantize(phrase, quant [,limit ] )");
+		return;
+	}
+	ph = needphr("quantize",ARG(0));
+	qnt = neednum("quantize",ARG(1));
+	if ( argc < 3 )
+		lim = qnt;
+	else
+		lim = neednum("quantize",ARG(2));
+	if ( qnt <= 0 )
+		qnt = 1;
+	d = phrdatum(newph(1));
+	for ( nt=firstnote(ph); nt!=NULL; nt=nextnote(nt) ) {
+		chkrealoften();
+		n = ntcopy(nt);
+		rem = timeof(n) % qnt;
+		if ( (rem*2) <= qnt )
+			delta = -rem;
+		else
+			delta = qnt-rem;
+		if ( delta >= -lim && delta <= lim )
+			timeof(n) += delta;
+		ntinsertbefore(n,d.u.phr);
+	}
+	d.u.phr->p_leng = xformleng(ph);
+	phdecruse(d.u.phr);
+	ret(d);
+}
+
+void
+bi_quantizedur(int argc)
+{
+	Phrasep ph;
+	Noteptr nt, n;
+	long qnt;
+	Datum d;
+
+	if ( argc < 2 ) {
+		xformusage("usage: quantizedur(phrase, quant )");
+		return;
+	}
+	ph = needphr("quantizedur",ARG(0));
+	qnt = neednum("quantizedur",ARG(1));
+	d = phrdatum(newph(1));
+	for ( nt=firstnote(ph); nt!=NULL; nt=nextnote(nt) ) {
+		chkrealoften();
+		n = ntcopy(nt);
+		(void) ntassign(n,DUR,numdatum(numquant(xformdur(n),qnt)),'=');
+		ntinsertbefore(n,d.u.phr);
+	}
+	d.u.phr->p_leng = xformleng(ph);
+	phdecruse(d.u.phr);
+	ret(d);
+}
+
+void
+bi_reverse(int argc)
+{
+	Phrasep ph;
+	Noteptr nt, n;
+	long leng;
+	Datum d;
+
+	if ( argc < 1 ) {
+		xformusage("usage: reverse(phrase)");
+		return;
+	}
+	ph = needphr("reverse",ARG(0));
+	leng = ph->p_leng;
+	d = phrdatum(newph(1));
+	for ( nt=firstnote(ph); nt!=NULL; nt=nextnote(nt) ) {
+		chkrealoften();
+		n = ntcopy(nt);
+		timeof(n) = leng - timeof(n) - xformdur(n);
+		ntinsertbefore(n,d.u.phr);
+	}
+	d.u.phr->p_leng = leng;
+	phdecruse(d.u.phr);
+	ret(d);
+}
+
+void
+bi_arpeggio(int argc)
+{
+	Phrasep ph;
+	Noteptr nt, n;
+	long lastend, dur;
+	Datum d;
+
+	if ( argc < 1 ) {
+		xformusage("usage: arpeggio(phrase)");
+		return;
+	}
+	ph = needphr("arpeggio",ARG(0));
+	lastend = 0;
+	d = phrdatum(newph(1));
+	for ( nt=firstnote(ph); nt!=NULL; nt=nextnote(nt) ) {
+		chkrealoften();
+		n = ntcopy(nt);
+		timeof(n) = lastend;
+		ntinsertbefore(n,d.u.phr);
+		dur = xformdur(n);
+		if ( dur == 0 )
+			dur = 1;
+		lastend += dur;
+	}
+	d.u.phr->p_leng = lastend;
+	phdecruse(d.u.phr);
+	ret(d);
+}
+
+/* Extends the duration of each note to abutt the start of the next note. */
+void
+bi_legato(int argc)
+{
+	Phrasep ph, non;
+	Noteptr nt, n, nextnt;
+	long leng;
+	Datum d;
+
+	if ( argc < 1 )
+		execerror("usage: legato(phrase)");
+	ph = needphr("legato",ARG(0));
+	d = phrdatum(newph(1));
+	leng = 0;
+	/* nextnt is the first note starting later than nt, if any */
+	nextnt = firstnote(ph);
+	for ( nt=firstnote(ph); nt!=NULL; nt=nextnote(nt) ) {
+		if ( ! ntisnote(nt) )
+			continue;
+		chkrealoften();
+		while ( nextnt!=NULL
+			&& (!ntisnote(nextnt) || timeof(nextnt)<=timeof(nt)) )
+			nextnt = nextnote(nextnt);
+		if ( endof(nt) > leng )
+			leng = endof(nt);
+		n = ntcopy(nt);
+		/* notes at the end of the phrase aren't touched */
+		if ( nextnt != NULL && timeof(nextnt) >= 0 )
+			(void) ntassign(n,DUR,numdatum(timeof(nextnt)-timeof(nt)),'=');
+		ntinsertbefore(n,d.u.phr);
+	}
+	/* the non-notes are merged back in unchanged */
+	non = newph(1);
+	phcutusertype(ph,non,NT_NOTE|NT_ON|NT_OFF,1);
+	phrmerge(non,d.u.phr,0L);
+	phdecruse(non);
+	if ( ph->p_leng >= leng )
+		leng = ph->p_leng;
+	d.u.phr->p_leng = leng;
+	phdecruse(d.u.phr);
+	ret(d);
+}
+
 void
 bi_midibytes(int argc)
 {
@@ -842,7 +1160,7 @@ bi_midibytes(int argc)
 		timeof(n) = 0L;
 		portof(n) = 0;
 #ifdef NTATTRIB
-		attribof(n) = Nullstr;
+		ntsetattrib(n,Nullstr);
 #endif
 		if ( nbytes <= 3 ) {
 			typeof(n) = NT_LE3BYTES;
@@ -938,6 +1256,7 @@ bi_argv(int argc)
 		n2 = neednum("argv",ARG(1));
 		da = newarrdatum(0,2*(npassed-n)+1);
 		for ( i=n; i<npassed && i<n2; i++ ) {
+			strfinishd(arg0+i);
 			d = *(arg0+i);
 			incruse(d);
 			setarraydata(da.u.arr,numdatum(i-n),d);
@@ -946,8 +1265,10 @@ bi_argv(int argc)
 	}
 	else if ( n<0 || n>=npassed ) /* Might want to complain when n<0 */
 		retval = Nullval;
-	else if ( argc == 1 )
+	else if ( argc == 1 ) {
+		strfinishd(arg0+n);
 		retval = *(arg0+n);
+	}
 	ret(retval);
 }
 
@@ -1596,8 +1917,8 @@ bi_garbcollect(int argc)
 {
 	if ( argc != 0 )
 		execerror("usage: garbcollect()");
-	phcheck();
-	htcheck();
+	reclaim(0L);
+	(void) strsweep(1);
 	ret(Nullval);
 }
 
@@ -1949,7 +2270,7 @@ wsettrack(Kwind *w,char *trk)
 		clearsym(pe);
 		*dp = phrdatum(newph(1));
 	}
-	w->trk = trk;
+	w->trk = uniqstr(trk);	/* so strsweep() won't free it */
 	w->pph = &(dp->u.phr);
 }
 
@@ -2120,6 +2441,22 @@ validoutputport(int portno)
 	return 1;
 }
 
+/* Return one of the LATENCYBUCKETS histograms as an array, indexed */
+/* by the lowest value (in milliseconds) counted in each bucket. */
+static Datum
+histdatum(long *hist)
+{
+	Datum d, dk;
+	int n;
+
+	d = newarrdatum(0,3);
+	for ( n=0; n<LATENCYBUCKETS; n++ ) {
+		dk = numdatum((n==0) ? 0L : (1L<<(n-1)));
+		setarraydata(d.u.arr,dk,numdatum(hist[n]));
+	}
+	return d;
+}
+
 void
 bi_midi(int argc)
 {
@@ -2151,6 +2488,12 @@ bi_midi(int argc)
 	 *     output isopen {n}
 	 *     output default {n}
 	 *     output default {n} {channel}
+	 *     timing
+	 *     timing reset
+	 *     thru
+	 *     thru reset
+	 *     bounce start
+	 *     bounce stop {filename}
 	 */
 
 	if ( strcmp(arg0,"input")==0 ) {
@@ -2266,8 +2609,10 @@ bi_midi(int argc)
 				goto getout;
 			}
 			r = mdep_midi(MIDI_CLOSE_OUTPUT,&Midioutputs[portno-1]);
-			if ( r == 0 )
+			if ( r == 0 ) {
 				Midioutputs[portno-1].opened = 0;
+				thruchanged();
+			}
 			d = numdatum(r);
 		}
 		else if ( strcmp(arg1,"open")==0 ) {
@@ -2298,6 +2643,7 @@ bi_midi(int argc)
 					for (k=0; k<16; k++)
 						Portmap[DEFPORT][k] = portno;
 				}
+				thruchanged();
 			}
 			d = numdatum(r);
 		}
@@ -2385,6 +2731,112 @@ bi_midi(int argc)
 				goto getout;
 			}
 			Portmap[p][ch] = outportno;
+			thruchanged();
+		}
+	}
+	else if ( strcmp(arg0,"timing")==0 ) {
+		/*
+		 * How late scheduled output has been handed to the
+		 * mdep layer (see Midilookahead), in milliseconds, and
+		 * how many calls to the mdep layer have been made (and
+		 * saved by batching the output of each pass).  Also
+		 * histograms of the lateness and of how long each pass
+		 * of chkmidioutput() took, and how often Midithrottle
+		 * and Maxatonce cut things short.  "cutoffs" is the
+		 * number of note-offs that were timed so that they'd
+		 * end a newer note of the same pitch instead of the
+		 * one they were for, counted while Midicutoffcheck
+		 * is set.
+		 */
+		if ( argc > 1 && strcmp(needstr("midi",ARG(1)),"reset")==0 ) {
+			Midioutcount = 0;
+			Midilatecount = 0;
+			Midilatetotal = 0;
+			Midilatemax = 0;
+			Midisends = 0;
+			Midisendsaved = 0;
+			Midipasses = 0;
+			Midithrottlehits = 0;
+			Miditoomany = 0;
+			Midicutoffs = 0;
+			clrcutoffs();
+			for ( n=0; n<LATENCYBUCKETS; n++ ) {
+				Midilatehist[n] = 0;
+				Midipasshist[n] = 0;
+			}
+		}
+		else {
+			d = newarrdatum(0,3);
+			setarraydata(d.u.arr,strdatum(uniqstr("count")),numdatum(Midioutcount));
+			setarraydata(d.u.arr,strdatum(uniqstr("late")),numdatum(Midilatecount));
+			setarraydata(d.u.arr,strdatum(uniqstr("totallate")),numdatum(Midilatetotal));
+			setarraydata(d.u.arr,strdatum(uniqstr("maxlate")),numdatum(Midilatemax));
+			setarraydata(d.u.arr,strdatum(uniqstr("sends")),numdatum(Midisends));
+			setarraydata(d.u.arr,strdatum(uniqstr("sendsaved")),numdatum(Midisendsaved));
+			setarraydata(d.u.arr,strdatum(uniqstr("passes")),numdatum(Midipasses));
+			setarraydata(d.u.arr,strdatum(uniqstr("throttled")),numdatum(Midithrottlehits));
+			setarraydata(d.u.arr,strdatum(uniqstr("toomany")),numdatum(Miditoomany));
+			setarraydata(d.u.arr,strdatum(uniqstr("cutoffs")),numdatum(Midicutoffs));
+			setarraydata(d.u.arr,strdatum(uniqstr("latehist")),histdatum(Midilatehist));
+			setarraydata(d.u.arr,strdatum(uniqstr("passhist")),histdatum(Midipasshist));
+		}
+	}
+	else if ( strcmp(arg0,"thru")==0 ) {
+		/*
+		 * Histograms of how long it took to echo MIDI input
+		 * through Merge, and through the mdep layer's fast
+		 * path (see Midithru).  Each is indexed by the lowest
+		 * latency (in milliseconds) counted in that bucket.
+		 */
+		if ( argc > 1 && strcmp(needstr("midi",ARG(1)),"reset")==0 ) {
+			for ( n=0; n<LATENCYBUCKETS; n++ ) {
+				Mergelatency[n] = 0;
+				Thrulatency[n] = 0;
+			}
+		}
+		else {
+			d = newarrdatum(0,3);
+			setarraydata(d.u.arr,strdatum(uniqstr("merge")),histdatum(Mergelatency));
+			setarraydata(d.u.arr,strdatum(uniqstr("thru")),histdatum(Thrulatency));
+		}
+	}
+	else if ( strcmp(arg0,"bounce")==0 ) {
+		/*
+		 * midi("bounce","start") runs the realtime scheduler
+		 * against a virtual clock that doesn't wait, capturing
+		 * the MIDI output rather than sending it.
+		 * midi("bounce","stop") goes back to the real clock and
+		 * returns the output as a phrase of MIDI bytes, and
+		 * midi("bounce","stop",filename) also writes it to a
+		 * MIDI file.
+		 */
+		char *s;
+
+		if ( argc < 2 )
+			execerror("usage: midi(\"bounce\",\"start\" or \"stop\" [,filename])");
+		s = needstr("midi",ARG(1));
+		if ( strcmp(s,"start")==0 ) {
+			bouncestart();
+		}
+		else if ( strcmp(s,"stop")==0 ) {
+			Phrasep p = bouncestop();
+
+			if ( p == NULL )
+				goto getout;
+			d = phrdatum(p);
+			if ( argc > 2 ) {
+				Datum da;
+
+				s = needstr("midi",ARG(2));
+				da = newarrdatum(0,1);
+				setarraydata(da.u.arr,numdatum(0),d);
+				arrtomf(da.u.arr,s);
+			}
+			phdecruse(p);	/* to reverse initial (1) */
+		}
+		else {
+			eprint("midi: Unrecognized bounce argument (%s).",s);
+			goto getout;
 		}
 	}
 	else {
@@ -2773,7 +3225,7 @@ bi_sprintf(int argc)
 
 	reinitmsg3();
 	keyprintf(fmt,1,argc-1,ptomsg3);
-	ret(strdatum(uniqstr(Msg3)));
+	ret(strdatum(uniqstrtmp(Msg3)));
 }
 
 #ifdef MDEBUG
@@ -2895,6 +3347,8 @@ struct bltinfo builtins[] = {
 	{ "coreleft",	bi_coreleft,	BI_CORELEFT },
 	{ "prstack",	bi_prstack,	BI_PRSTACK },
 	{ "phdump",	bi_phdump,	BI_PHDUMP },
+	{ "phrasestats",	bi_phrasestats,	BI_PHRASESTATS },
+	{ "stringstats",	bi_stringstats,	BI_STRINGSTATS },
 	{ "lsdir",	bi_lsdir,	BI_LSDIR },
 	{ "attribarray",	bi_attribarray,	BI_ATTRIBARRAY },
 	{ "fifoctl",	bi_fifoctl,	BI_FIFOCTL },
@@ -2902,6 +3356,15 @@ struct bltinfo builtins[] = {
 	{ "midi",		bi_midi,	BI_MIDI },
 	{ "bitmap",	bi_bitmap,	BI_BITMAP },
 	{ "objectinfo",	bi_objectinfo,	BI_OBJECTINFO },
+/* PHRASE TRANSFORMS (formerly in lib/basic1.k) */
+	{ "transpose",	bi_transpose,	BI_TRANSPOSE },
+	{ "quantize",	bi_quantize,	BI_QUANTIZE },
+	{ "quantizedur",	bi_quantizedur,	BI_QUANTIZEDUR },
+	{ "reverse",	bi_reverse,	BI_REVERSE },
+	{ "arpeggio",	bi_arpeggio,	BI_ARPEGGIO },
+	{ "scavol",	bi_scavol,	BI_SCAVOL },
+	{ "scadur",	bi_scadur,	BI_SCADUR },
+	{ "legato",	bi_legato,	BI_LEGATO },
 	{ 0,		0,		0 }
 };
 
@@ -3035,5 +3498,15 @@ BLTINFUNC Bltinfuncs[] = {
 	bi_midi,
 	bi_bitmap,
 	bi_objectinfo,
-	o_fillpolygon
+	o_fillpolygon,
+	bi_transpose,
+	bi_quantize,
+	bi_quantizedur,
+	bi_reverse,
+	bi_arpeggio,
+	bi_scavol,
+	bi_scadur,
+	bi_legato,
+	bi_phrasestats,
+	bi_stringstats
 };
@@ -921,7 +921,7 @@ callfuncd(Symbolp s)
 	}
 
 	if ( bi != 0 ) {
-		if (bi > 127) {
+		if (bi > BI_LAST) {
 			eprint("Internal error: bi=%d\n", bi);
 		}
 		/* it's a built-in function - execute it right away */
@@ -1026,11 +1026,13 @@ ret(Datum retd)
 		Datum d2;
 		d2 = ARG(n);
 		decruse(d2);
+		strdropd(d2);
 	}
 	for ( n=0; n<nlocals; n++ ) {
 		Datum d2;
 		d2 = (*(T->stackframe-FRAMEHEADER-(n)));
 		decruse(d2);
+		strdropd(d2);
 	}
 	Stackp = tstackframe-varsize-FRAMEHEADER-PREARGSIZE;
 
@@ -1068,8 +1070,10 @@ symdataptr(Symbolp s)
 	if ( sp > 127 )
 		sp -= 256;
 	
-	if ( sp == 0 )		/* it's a global var */
+	if ( sp == 0 ) {	/* it's a global var */
+		chkrecorded(s);
 		return &(s->sd);
+	}
 
 	if ( sp > 0 )		/* it's a parameter var */
 		return T->arg0 + sp - 1;
@@ -155,12 +155,7 @@ i_undefine(void)
 Phrasep
 phresh(Phrasep p)
 {
-	if ( phreallyused(p) > 0 ) {
-		Phrasep ph = newph(0);
-		phcopy(ph,p);
-		p = ph;
-	}
-	return p;
+	return phcow(p,0,0);
 }
 
 Datum
@@ -287,13 +282,13 @@ addstr(Symstr s1,Symstr s2)
 		snew = (Symstr) kmalloc((unsigned)need,"addstr");
 		strcpy(snew,(char*)s1);
 		strcat(snew,(char*)s2);
-		p = uniqstr((char*)snew);
+		p = uniqstrtmp((char*)snew);
 		kfree(snew);
 	}
 	else {
 		strcpy(s,s1);
 		strcat(s,s2);
-		p = uniqstr(s);
+		p = uniqstrtmp(s);
 	}
 	return p;
 }
@@ -590,7 +585,7 @@ setval(Noteptr n,int field,Datum nv)
 
 #ifdef NTATTRIB
 	if ( field == ATTRIB ) {
-		attribof(n) = dtostr(nv);
+		ntsetattrib(n,dtostr(nv));
 		return;
 	}
 #endif
@@ -684,6 +679,86 @@ ntassign(Noteptr n,int dottype,Datum v,int op)
 	return nv;
 }
 
+/* The value of "v <op> e" in phdotassign() */
+#define DOTOP(v) (op=='='?e:op=='+'?(v)+e:op=='-'?(v)-e:op=='*'?(v)*e:(v)/e)
+
+/*
+ * phdotassign(p,dottype,e,op,asum,an)
+ *
+ * Does "p.<dottype> <op>= e" for an integer e, with the same result as
+ * calling ntassign() on each note, but without going through a Datum
+ * and a switch on the type of value for every note.  The sum and number
+ * of the assigned values that aren't negative (from which assign()
+ * computes its result) are put in *asum and *an.  Returns 0, having
+ * done nothing, for the fields and operators it doesn't handle.
+ */
+
+static int
+phdotassign(Phrasep p,int dottype,long e,int op,long *asum,int *an)
+{
+	register Noteptr nt;
+	register long v;
+	long sum = 0;
+	int n = 0;
+	Datum dv;
+
+	if ( op!='=' && op!='+' && op!='-' && op!='*' && (op!='/' || e==0) )
+		return 0;
+	if ( dottype!=PITCH && dottype!=VOL && dottype!=DUR
+		&& dottype!=TIME && dottype!=CHAN )
+		return 0;
+	for ( nt=firstnote(p); nt!=NULL; nt=nextnote(nt) ) {
+		chkrealoften();
+		if ( ntisbytes(nt) ) {
+			/* only some fields apply, leave it to ntassign */
+			dv = ntassign(nt,dottype,numdatum(e),op);
+			if ( dv.type == D_NUM && (v=numval(dv)) >= 0 ) {
+				sum += v;
+				n++;
+			}
+			continue;
+		}
+		/* the clipping here is the same as setval() does */
+		switch (dottype) {
+		case PITCH:
+			v = DOTOP(pitchof(nt));
+			pitchof(nt) = (Unchar)SANIVALUE(v);
+			break;
+		case VOL:
+			v = DOTOP(volof(nt));
+			volof(nt) = (Unchar)SANIVALUE(v);
+			break;
+		case DUR:
+			v = DOTOP(durof(nt));
+			if ( v < 0 )
+				durof(nt) = 0;
+			else if ( v > MAXDURATION )
+				setval(nt,DUR,numdatum(v));	/* it warns */
+			else
+				durof(nt) = v;
+			break;
+		case TIME:
+			v = DOTOP(timeof(nt));
+			timeof(nt) = v;
+			break;
+		case CHAN:
+			v = DOTOP(1+chanof(nt));
+			setchanof(nt) = (Unchar)(v<1 ? 0 : (v>16 ? 15 : v-1));
+			break;
+		default:
+			v = -1;
+			break;
+		}
+		if ( v >= 0 ) {
+			sum += v;
+			n++;
+		}
+	}
+	*asum = sum;
+	*an = n;
+	return 1;
+}
+
 void
 phrvarinit(Symbolp s)
 {
@@ -730,7 +805,6 @@ assign(int type, int dottype)
 	int op, n, usepreval=0;
 	Symbolp s;
 	Datum *sdp;
-	Phrasep p;
 	long sum, modval=0, val;
 	Noteptr nt;
 	int dontpush;
@@ -825,9 +899,16 @@ assign(int type, int dottype)
 			/* don't do a decruse(sd) !! */
 			clearsym(s);
 		}
+		else if ( op == '+' && sd.type == D_STR && expr.type == D_STR
+				&& ! isglobal(s) ) {
+			/* Building up a local string, see strappend() */
+			result = strdatum(strappend(sd.u.str,expr.u.str));
+		}
 		else {
 			decruse(sd);
 			result = datumdoop(sd,expr,op);
+			if ( result.type != D_STR || result.u.str != sd.u.str )
+				strdropd(sd);
 		}
 		s->stype = VAR;
 		*sdp = result;
@@ -839,11 +920,7 @@ assign(int type, int dottype)
 
 		/* if the symbol's data is used elsewhere, we */
 		/* have to make a fresh copy. */
-		if ( phreallyused(sd.u.phr) > 0 ) {
-			p = newph(0);
-			phcopy(p,sd.u.phr);
-			sdp->u.phr = sd.u.phr = p;
-		}
+		sdp->u.phr = sd.u.phr = phcow(sd.u.phr,0,0);
 
 		if ( dottype == LENGTH ) {
 			Datum v;
@@ -856,8 +933,11 @@ assign(int type, int dottype)
 		/* Do assign operation on each note of the phrase. */
 		/* Since this is potentially expensive, we let realtime */
 		/* stuff sneak in (via chkrealoften()). */
-		sum = 0;
-		for ( n=0,nt=firstnote(sd.u.phr); nt!=NULL; nt=nextnote(nt) ) {
+		/* The common case of an integer value has its own loop. */
+		if ( expr.type != D_NUM || ! phdotassign(sd.u.phr,dottype,
+				expr.u.val,op,&sum,&n) ) {
+		    sum = 0;
+		    for ( n=0,nt=firstnote(sd.u.phr); nt!=NULL; nt=nextnote(nt) ) {
 			Datum dv;
 
 			chkrealoften();
@@ -869,12 +949,13 @@ assign(int type, int dottype)
 					n++;
 				}
 			}
+		    }
 		}
 
 		/* This expensive call to phreorder is probably overkill, */
 		/* since we've only changed a single note.  NEEDS WORK!  */
 		/* It would be easy if the phrases were doubly-linked. */
-		phreorder(sd.u.phr,0L);
+		phreorder(sd.u.phr);
 
 		/* The result is the average of the assigned values. */
 		result = numdatum( n==0 ? 0L : (long)(sum / n) );
@@ -889,11 +970,7 @@ assign(int type, int dottype)
 		}
 		/* if the symbol's data is used exactly once, then we */
 		/* re-use it.  Otherwise we have to make a copy. */
-		if ( phreallyused(sd.u.phr) > 0 ) {
-			p = newph(0);
-			phcopy(p,sd.u.phr);
-			sdp->u.phr = sd.u.phr = p;
-		}
+		sdp->u.phr = sd.u.phr = phcow(sd.u.phr,0,0);
 
 		nt = picknt(sd.u.phr, (int)modval);
 		if ( usepreval && nt != NULL ) {
@@ -904,7 +981,7 @@ assign(int type, int dottype)
 			result = ntassign(nt,dottype,expr,op);
 
 		/* This call to phreorder is possible overkill, see above. */
-		phreorder(sd.u.phr,0L);
+		phreorder(sd.u.phr);
 
 		break;
 
@@ -919,11 +996,7 @@ assign(int type, int dottype)
 
 		/* if the symbol's data is used exactly once, then we */
 		/* re-use it.  Otherwise we have to make a copy. */
-		if ( phreallyused(sd.u.phr) > 0 ) {
-			p = newph(0);
-			phcopy(p,sd.u.phr);
-			sdp->u.phr = sd.u.phr = p;
-		}
+		sdp->u.phr = sd.u.phr = phcow(sd.u.phr,0,0);
 
 		lnt = picknt(sd.u.phr, (int)modval);
 		rnt = picknt(expr.u.phr, PHRASEBASE);
@@ -949,7 +1022,7 @@ assign(int type, int dottype)
 			}
 		}
 		/* This call to phreorder is possible overkill, see above. */
-		phreorder(sd.u.phr,0L);
+		phreorder(sd.u.phr);
 		result = expr;
 	    }
 		break;
@@ -958,6 +1031,11 @@ assign(int type, int dottype)
 	incruse(sd);
 
 	if ( ! dontpush ) {
+		if ( type == ASSIGN ) {
+			/* the value gets used, so it can't still be being built */
+			strfinishd(sdp);
+			result = *sdp;
+		}
 		/* This originally was:   pushexp( usepreval ? preval : result ); */
 		/* But the Zortech compiler seemed to have trouble with that. */
 		if ( usepreval ) {
@@ -16,6 +16,10 @@ void bi_prstack(int argc)
 ;
 void bi_phdump(int argc)
 ;
+void bi_phrasestats(int argc)
+;
+void bi_stringstats(int argc)
+;
 int tasklistcollect(Hnodep h)
 ;
 void bi_taskinfo(int argc)
@@ -74,6 +78,22 @@ void bi_split(int argc)
 ;
 void bi_cut(int argc)
 ;
+void bi_transpose(int argc)
+;
+void bi_scavol(int argc)
+;
+void bi_scadur(int argc)
+;
+void bi_quantize(int argc)
+;
+void bi_quantizedur(int argc)
+;
+void bi_reverse(int argc)
+;
+void bi_arpeggio(int argc)
+;
+void bi_legato(int argc)
+;
 void bi_midibytes(int argc)
 ;
 #ifdef NTATTRIB
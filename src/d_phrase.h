@@ -14,10 +14,24 @@ Midimessp savemess(Unchar* mess,int leng)
 ;
 void ntfree(Noteptr n)
 ;
-Noteptr  ntcopy(register Noteptr n)
+#ifdef NTATTRIB
+#endif
+#ifdef NTATTRIB
+char * ntattrib(Noteptr n)
+;
+void ntsetattrib(Noteptr n,char *att)
+;
+#endif
+void attribvisit(STRFUNC f)
 ;
 #ifdef NTATTRIB
 #endif
+#ifdef NTATTRIB
+#endif
+Noteptr  ntcopy(register Noteptr n)
+;
+void ntreplace(Noteptr nn,Noteptr n)
+;
 void freents(Noteptr n)
 ;
 int bytescmp(Noteptr n1,Noteptr n2)
@@ -36,9 +50,15 @@ int ntcmpxact(register Noteptr n1,register Noteptr n2)
 #endif
 #ifdef NTATTRIB
 #endif
-void phcopy(Phrasep out,Phrasep in)
+long phcopy(Phrasep out,Phrasep in)
+;
+Phrasep phcow(Phrasep p,int maxused,int inituse)
+;
+Noteptr ntmergelist(Noteptr a,Noteptr b)
+;
+Noteptr ntsortlist(Noteptr n)
 ;
-void phreorder(Phrasep ph,long tmout)
+void phreorder(Phrasep ph)
 ;
 #ifdef DONTDO
 #endif
@@ -50,6 +70,10 @@ void phcutflags(Phrasep pin,Phrasep pout,long mask)
 ;
 void phcutchannel(Phrasep pin,Phrasep pout,int chan)
 ;
+Ntindex * phindex(Phrasep p)
+;
+void phunindex(Phrasep p)
+;
 void phcut(Phrasep pin,Phrasep pout,long tm1,long tm2,int p1,int p2)
 ;
 void phcutincl(Phrasep pin,Phrasep pout,long tm1,long tm2)
@@ -62,8 +86,12 @@ Phrasep newph(int inituse)
 ;
 void reinitph(register Phrasep p)
 ;
+void phunladder(Phrasep p)
+;
 void ntinsert(Noteptr n,Phrasep p)
 ;
+void ntinsertbefore(Noteptr n,Phrasep p)
+;
 void ntdelete(register Phrasep ph,register Noteptr nt)
 ;
 int usertypeof(Noteptr nt)
@@ -2,6 +2,16 @@ void chksched(char *str)
 ;
 void psched(void)
 ;
+long nextschedtime(void)
+;
+int taskschedtime(Ktaskp t, long *clk)
+;
+void clrcutoffs(void)
+;
+void latencyhist(long *hist,long ms)
+;
+void thruchanged(void)
+;
 void resetcurrphr(void)
 ;
 void initmidiport(Midiport *p)
@@ -12,6 +22,12 @@ void clrcontroller(void)
 ;
 void newtempo(long t)
 ;
+void bouncestart(void)
+;
+void bounceto(long clk)
+;
+Phrasep bouncestop(void)
+;
 void resetreal(void)
 ;
 void finishoff(void)
@@ -30,7 +46,7 @@ Unchar * ustrchr(Unchar *pn,int n)
 ;
 int chanofbyte(int b)
 ;
-int execnt(register Sched *s, Sched *pres)
+int execnt(register Sched *s)
 ;
 void toomany(char *onoff)
 ;
@@ -86,9 +102,11 @@ void notemess(Noteptr q)
 #endif
 void ntrecord(Noteptr n)
 ;
+void recflush(void)
+;
 #ifdef OLDSTUFF
 #endif
-void clrsched(Sched **as)
+void clrsched(void)
 ;
 Sched * newsch(void)
 ;
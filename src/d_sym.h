@@ -108,14 +108,26 @@ Htablep newht(int size)
 ;
 void clearht(Htablep ht)
 ;
-#ifdef lint
-#endif
+long clearhtsome(Htablep ht,long budget,int *pos)
+;
 void freeht(Htablep ht)
 ;
 void htlists(void)
 ;
 Symstr uniqstr(char *s)
 ;
+Symstr uniqstrtmp(char *s)
+;
+Symstr strappend(Symstr s1,Symstr s2)
+;
+Symstr strfinish(Symstr s)
+;
+void strdrop(Symstr s)
+;
+long strsweep(int force)
+;
+void strchains(long *nchains,long *nused,long *maxleng)
+;
 int isundefd(Symbolp s)
 ;
 Hnodep hashtable(Htablep ht,Datum key,int action)
@@ -124,8 +136,6 @@ Symbolp arraysym(Htablep arr,Datum subs,int action)
 ;
 int arrsize(Htablep arr)
 ;
-int dtcmp(Datum *d1,Datum *d2)
-;
 Datum * arrlist(Htablep arr,int *asize,int sortit)
 ;
 void hashvisit(Htablep arr,HNODEFUNC f)
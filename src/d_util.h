@@ -14,6 +14,10 @@ void htcheck(void)
 ;
 #ifdef lint
 #endif
+long reclaimnotes(long budget)
+;
+int reclaim(long budget)
+;
 char * strend(register char *s)
 ;
 #ifdef OLDRAND
@@ -38,6 +42,8 @@ void phprint(PFCHAR pfunc,Phrasep ph,int nl)
 #endif
 void nttostr(Noteptr n,char *buff)
 ;
+Phstats * phstats(Phrasep p)
+;
 int phsize(register Phrasep p,register int notes)
 ;
 Noteptr picknt(register Phrasep ph,register int picknum)
@@ -202,7 +202,7 @@ flushlinebuff(Fifo* f)
 {
 	if ( ((f->flags)&FIFO_READ) && f->linebuff!=NULL && f->linesofar > 0 ){
 		f->linebuff[f->linesofar] = '\0';
-		putfifo(f,strdatum(uniqstr(f->linebuff)));
+		putfifo(f,strdatum(uniqstrtmp(f->linebuff)));
 		f->linesofar = 0;
 	}
 }
@@ -832,7 +832,7 @@ getfromfifo(Fifo *f)
 					c = getc(f->fp);
 				}
 				Msg1[i] = '\0';
-				ret(strdatum(uniqstr(Msg1)));
+				ret(strdatum(uniqstrtmp(Msg1)));
 			}
 		}
 	}
@@ -44,6 +44,14 @@
 #define UINT16 unsigned INT16
 #endif
 
+#ifndef INT32
+#define INT32 int
+#endif
+
+#ifndef MAXINT32
+#define MAXINT32 0x7fffffff
+#endif
+
 typedef unsigned char Unchar;
 typedef Unchar *Codep;
 typedef struct Instnode *Instnodep;
@@ -394,6 +402,17 @@ typedef void (*PATHFUNC)();
 #define BI_BITMAP	125
 #define BI_OBJECTINFO	126
 #define O_FILLPOLYGON	127
+#define BI_TRANSPOSE	128
+#define BI_QUANTIZE	129
+#define BI_QUANTIZEDUR	130
+#define BI_REVERSE	131
+#define BI_ARPEGGIO	132
+#define BI_SCAVOL	133
+#define BI_SCADUR	134
+#define BI_LEGATO	135
+#define BI_PHRASESTATS	136
+#define BI_STRINGSTATS	137
+#define BI_LAST		BI_STRINGSTATS	/* the largest BI_* or O_* value */
 
 #define IO_STD 1
 #define IO_REDIR 2
@@ -580,16 +599,44 @@ typedef struct Hnode {
 } Hnode;
 
 #define HT_TOBECHECKED 1
+#define HT_TOFREE 2
+
+/* Marks a deleted element in an Htslot */
+#define HT_DELETED (&Htdeleted)
+extern Hnode Htdeleted;
+
+/* Arrays are open-addressed hash tables, with linear probing.  Each */
+/* slot holds the key's value (key.u.val, the uniqstr'ed key.u.str */
+/* pointer, or key.u.obj->id) and type, so probing doesn't need to */
+/* look at the Hnodes.  When a table fills up, it's rehashed into a */
+/* bigger one a few slots at a time (see hashtable()).  Elements with */
+/* numeric keys 0, 1, 2, ... (as long as they're contiguous from 0) */
+/* are kept in the dense vector instead, indexed by the key. */
+typedef struct Htslot {
+	long k;
+	int ktype;
+	Hnodep node;	/* NULL if empty, or HT_DELETED */
+} Htslot;
 
 typedef struct Htable {
-	int size;	/* size of nodetable */
+	int size;	/* number of slots */
 	int count;	/* number of actual elements */
 	short h_used;
 	short h_tobe;
-	Hnodepp nodetable;
+	Htslot *slots;
+	int nused;	/* slots holding an element */
+	int ndeleted;	/* slots holding HT_DELETED */
+	Htslot *oldslots;	/* non-NULL while being rehashed into slots */
+	int oldsize;
+	int oldpos;	/* oldslots before this have been moved */
+	int h_visiting;	/* hashvisit()s in progress, which hold off rehashing */
+	Hnodep *dense;	/* elements with keys 0 to ndense-1, never in slots */
+	int ndense;
+	long densesize;	/* bytes allocated for dense, see makeroom() */
+	Datum *h_sorted;	/* keys in order, see arrlist() */
 	Htablep h_next;
 	Htablep h_prev;
-	short h_state;	/* HT_TOBECHECKED or 0 */
+	short h_state;	/* HT_TOBECHECKED, HT_TOFREE, or 0 */
 } Htable;
 
 typedef Htablep *Htablepp;
@@ -640,9 +687,6 @@ extern BLTINFUNC Bltinfuncs[];
 
 typedef struct Ktask *Ktaskp;
 
-#define OFF_USER 0
-#define OFF_INTERNAL 1
-
 typedef enum {
 	FIFOTYPE_UNTYPED,
 	FIFOTYPE_BINARY,
@@ -652,14 +696,17 @@ typedef enum {
 } Fifotype;
 
 typedef struct schednode {
-	struct schednode *next;
+	struct schednode *next;		/* only used in the free list */
 	long clicks;			/* scheduled time */
+	unsigned long seq;		/* order within the same click */
+	int heapindex;			/* position in Schedheap */
 	char type;			/* SCH_* */
-	char offtype;			/* for SCH_NOTEOFF) */
 	char monitor;			/* If 1, add to Monitorfifo */
 	Phrasep phr;			/* for SCH_PHRASE */
-	Noteptr note;			/* for SCH_NOTEOFF and SCH_PHRASE. */
+	Noteptr note;			/* for SCH_PHRASE */
 	Ktaskp task;
+	struct schednode *tnext;	/* list of the task's Sched nodes */
+	struct schednode *tprev;
 	long repeat;			/* if > 0, a repeat time. */
 } Sched;
 
@@ -683,6 +730,8 @@ typedef struct Ktask {
 	int priority;	/* 0=normal, >0 is high priority */
 	Codep first;	/* first instruction */
 	int schedcnt;	/* number of scheduled events due to this task */
+	Sched *schedlist;	/* its Sched nodes */
+	int noteoffs;	/* its pending note-offs (see real.c), or -1 */
 	long cnt;	/* number of instructions executed */
 	int tmp;	/* for temporary use as a flag, counter, etc. */
 	Ktaskp twait;   /* if state==T_WAITING, we're waiting for this */
@@ -811,7 +860,7 @@ extern Midiport Midioutputs[MIDI_OUT_DEVICES];
 
 #define FIFOINC 64
 
-#define SCH_NOTEOFF 0
+/* Note-offs that complete NT_NOTEs aren't Sched nodes, see real.c */
 #define SCH_PHRASE 1
 #define SCH_WAKE 2
 
@@ -823,7 +872,12 @@ extern Midiport Midioutputs[MIDI_OUT_DEVICES];
 
 #define disabled(s) ((s)->clicks==MAXCLICKS)
 
-extern Sched *Topsched;
+extern Sched **Schedheap;
+extern int Nsched;
+
+/* The earliest scheduled event (or NULL if nothing is scheduled) */
+#define firstsched() (Nsched>0?Schedheap[0]:(Sched*)NULL)
+
 extern long Earliest;
 extern Htablep Keywords;
 extern Htablep Macros;
@@ -918,6 +972,11 @@ extern Datum _Dnumtmp_;
 
 #define incruse(d) {if((d).type==D_PHR)phincruse((d).u.phr) else if((d).type==D_ARR)arrincruse((d).u.arr)}
 #define decruse(d) {if((d).type==D_PHR)phdecruse((d).u.phr) else if((d).type==D_ARR)arrdecruse((d).u.arr)}
+/* A local variable's string that's being built by "+=" (see strappend()) */
+/* has to be interned before anything else refers to it, and freed when */
+/* the variable goes away. */
+#define strfinishd(dp) {if((dp)->type==D_STR&&Nstrbuilds>0)(dp)->u.str=strfinish((dp)->u.str);}
+#define strdropd(d) {if((d).type==D_STR&&Nstrbuilds>0)strdrop((d).u.str);}
 
 #define peekinto(x) x = *(Stackp - 1)
 #define popinto(x) \
@@ -1038,6 +1097,9 @@ extern Phrasep _Icphr;
 extern Codep _Icin;
 extern Phrasep Tobechecked;
 extern Htablep Htobechecked;
+extern long Reclaimed, Reclaimmax;
+extern long Nstrings, Strbytes, Ntmpstrings, Strswept, Nstrsweeps;
+extern int Nstrbuilds;
 extern int Chkstuff;
 extern int Keycnt;
 extern int Argc;
@@ -1074,6 +1136,14 @@ extern Htablepp Track;
 extern Htablepp Chancolormap;
 extern int Midiok;
 extern long Chkcount;
+extern long Midioutcount, Midilatecount, Midilatetotal, Midilatemax;
+extern long Midisends, Midisendsaved;
+/* Latency histograms: bucket 0 counts 0 ms, bucket i counts 2^(i-1) */
+/* up to 2^i ms, and the last bucket counts anything longer. */
+#define LATENCYBUCKETS 12
+extern long Mergelatency[LATENCYBUCKETS], Thrulatency[LATENCYBUCKETS];
+extern long Midilatehist[LATENCYBUCKETS], Midipasshist[LATENCYBUCKETS];
+extern long Midipasses, Midithrottlehits, Miditoomany, Midicutoffs;
 
 /* Global keykit variables */
 extern Symlongp Clicks, Merge, Debug, Now, Sync, Lag, Graphics, Mergefilter;
@@ -1084,6 +1154,7 @@ extern Symlongp Filter, Record, Recsched, Debugdraw, Recfilter, Recinput;
 extern Symlongp Loadverbose, Throttle2, Warnnegative, Midifilenoteoff;
 extern Symlongp Drawcount, Mousedisable, Forceinputport, Mfsysextype;
 extern Symlongp Lowcorelim, Arraysort, Tempotrack, Debugoff, Fakewrap;
+extern Symlongp Phindexmin, Reclaimslice, Strsweep;
 extern Symlongp Defrelease, Onoffmerge, Grablimit, Mfformat, Defoutport;
 extern Symlongp Taskaddr, Debuginst, Prepoll, Debugmalloc, Linetrace;
 extern Symlongp Debugkill, Debugkill1, Consecho, Abortonint, Abortonerr;
@@ -1100,6 +1171,13 @@ extern Symlongp Deftimeout;
 extern Symlongp Debuggesture;
 extern Symlongp Chancolors;
 extern Phrasepp Currphr, Recphr;
+extern long Reclogged;
+extern int Bouncing;
+extern long Bounceclock;
+
+/* Recorded notes are kept in a log until something looks at the */
+/* Recorded variable, see recflush(). */
+#define chkrecorded(s) do {if(Reclogged!=0&&&((s)->sd.u.phr)==Recphr)recflush();} while(0)
 extern Symstrp Keypath, Musicpath, Keyroot, Initconfig, Keypagepersistent;
 extern Symstrp Printsep, Printend, Pathsep, Dirseparator, Devmidi, Machine;
 extern int Dbg, Inerror, Usestdio, ReadytoEval;
@@ -1122,6 +1200,12 @@ int yyparse(NOARG);
 #define ARRAYHASHSIZE 251
 #endif
 
+/* Hash tables that have grown past this many slots don't keep them */
+/* when they're freed (see freeht()). */
+#ifndef HTKEEPSIZE
+#define HTKEEPSIZE 4096
+#endif
+
 #ifndef DEFLOWLIM
 #define DEFLOWLIM 50000
 #endif
@@ -1133,7 +1217,8 @@ int yyparse(NOARG);
 #define BIGBUFSIZ 4096
 
 #ifndef MILLICLOCK
-#define MILLICLOCK mdep_milliclock()
+/* See Bouncing, in real.c */
+#define MILLICLOCK (Bouncing?Bounceclock:mdep_milliclock())
 #endif
 
 #ifndef MIDISENDLIMIT
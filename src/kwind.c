@@ -724,7 +724,7 @@ newkitem(char *name)
 	Kitem *ki;
 
 	ki = (Kitem * ) kmalloc(sizeof(Kitem),"newkitem");
-	ki->name = name;
+	ki->name = uniqstr(name);	/* so strsweep() won't free it */
 	ki->next = NULL;
 	return ki;
 }
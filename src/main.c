@@ -525,7 +525,7 @@ NO_RETURN_ATTRIBUTE
 		eprint("Hmmm, T==NULL in execerror!?\n");
 
 	/* When we get an error in one task, we don't want */
-	/* to clear Topsched and do other things that screw up realtime, */
+	/* to clear the schedule and do other things that screw up realtime, */
 	/* so we no longer call resetstuff() here. */
 	/* resetstuff(); */
 
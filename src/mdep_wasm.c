@@ -1,5 +1,6 @@
 #include "key.h"
 #include <emscripten.h>
+#include <emscripten/heap.h>
 #include <sys/time.h>
 #include <unistd.h>
 #include <dirent.h>
@@ -38,7 +39,7 @@ extern void js_get_midi_input_name(int index, char *buffer, int buffer_size);
 extern void js_get_midi_output_name(int index, char *buffer, int buffer_size);
 extern int js_open_midi_input(int index);
 extern int js_close_midi_input(int index);
-extern int js_send_midi_output(int index, unsigned char *data, int data_len);
+extern int js_send_midi_output(int index, unsigned char *data, int data_len, int delay);
 
 // Mouse and keyboard functions
 extern void js_setup_mouse_events();
@@ -211,7 +212,17 @@ mdep_currtime(void)
 long
 mdep_coreleft(void)
 {
-    return 1024 * 1024 * 1024; // Fake 1GB free
+    // The heap can grow up to emscripten_get_heap_max(), and everything
+    // below the current break is in use (KeyKit keeps freed notes and
+    // phrases on its own free lists, so the break rarely comes down).
+    size_t max = emscripten_get_heap_max();
+    size_t used = (size_t)sbrk(0);
+
+    if (used >= max)
+        return 0;
+    if (max - used > (size_t)MAXLONG)
+        return MAXLONG;
+    return (long)(max - used);
 }
 
 int
@@ -306,13 +317,47 @@ mdep_resetclock(void)
 
 // MIDI implementation using Web MIDI API via JavaScript
 
-// MIDI message buffer for incoming data
-#define MIDI_BUFFER_SIZE 1024
-static unsigned char midi_input_buffer[MIDI_BUFFER_SIZE];
-static int midi_buffer_read_pos = 0;
-static int midi_buffer_write_pos = 0;
-static int midi_buffer_count = 0;
-static int midi_messages_received = 0; // Debug counter
+// Ring of incoming MIDI messages, one entry per message, with the
+// input device it came from and when it arrived.  Messages longer
+// than 3 bytes (sysex) keep their bytes in midi_sysex_ring.
+typedef struct {
+    int port;                   // input device index
+    long tm;                    // arrival time, in mdep_milliclock() terms
+    int leng;                   // number of bytes in the message
+    unsigned char data[3];      // the bytes, if leng <= 3
+} MidiInEvent;
+
+#define MIDI_EVENT_RING_SIZE 1024
+static MidiInEvent midi_event_ring[MIDI_EVENT_RING_SIZE];
+static int midi_event_read_pos = 0;
+static int midi_event_write_pos = 0;
+static int midi_event_count = 0;
+static int midi_event_partial = 0;  // bytes already read of the first event
+
+#define MIDI_SYSEX_RING_SIZE 8192
+static unsigned char midi_sysex_ring[MIDI_SYSEX_RING_SIZE];
+static int midi_sysex_read_pos = 0;
+static int midi_sysex_write_pos = 0;
+static int midi_sysex_count = 0;
+
+// Statistics, see mdep("midiinput","stats")
+static long midi_messages_received = 0;
+static long midi_messages_dropped = 0;  // because a ring was full
+static long midi_event_highwater = 0;   // most events queued at once
+static long midi_sysex_highwater = 0;   // most sysex bytes queued at once
+
+// MIDI thru (see Midithru in real.c): channel messages whose type bit
+// (1<<(status>>4)) is set in midi_thru_types are sent straight on to
+// the routed outputs when they arrive, before they're queued.
+#define MIDI_THRU_OUTS 4
+typedef struct {
+    int nouts;
+    Midiport *outs[MIDI_THRU_OUTS];
+    int offset;                 // added to the pitch of notes
+} MidiThruRoute;
+
+static MidiThruRoute midi_thru_routes[MIDI_IN_DEVICES][16];
+static int midi_thru_types = 0;
 
 // Keyboard input buffer for incoming keypresses
 typedef struct {
@@ -370,30 +415,101 @@ static int window_resize_pending = 0;
 static int last_canvas_width = 0;
 static int last_canvas_height = 0;
 
-// Callback from JavaScript when MIDI message is received
+static MidiInEvent *
+midi_event_put(int device_index, int leng, int age)
+{
+    MidiInEvent *e;
+
+    if (midi_event_count >= MIDI_EVENT_RING_SIZE) {
+        midi_messages_dropped++;
+        return NULL;
+    }
+    e = &midi_event_ring[midi_event_write_pos++];
+    if (midi_event_write_pos >= MIDI_EVENT_RING_SIZE)
+        midi_event_write_pos = 0;
+    if (++midi_event_count > midi_event_highwater)
+        midi_event_highwater = midi_event_count;
+    midi_messages_received++;
+    e->port = device_index;
+    e->tm = mdep_milliclock() - age;
+    e->leng = leng;
+    return e;
+}
+
+static void
+midi_thru(int device_index, int status, int data1, int data2, int leng, int age)
+{
+    MidiThruRoute *r;
+    unsigned char msg[3];
+    int i, pitch;
+
+    if (device_index < 0 || device_index >= MIDI_IN_DEVICES)
+        return;
+    if ((midi_thru_types & (1 << ((status >> 4) & 0xf))) == 0)
+        return;
+    r = &midi_thru_routes[device_index][status & 0xf];
+    if (r->nouts <= 0)
+        return;
+    msg[0] = (unsigned char)status;
+    msg[1] = (unsigned char)data1;
+    msg[2] = (unsigned char)data2;
+    // note-on and note-off
+    if ((status & 0xe0) == 0x80 && r->offset != 0) {
+        pitch = data1 + r->offset;
+        if (pitch >= 0 && pitch < 128)
+            msg[1] = (unsigned char)pitch;
+    }
+    for (i = 0; i < r->nouts; i++)
+        mdep_putnmidi(leng, (char*)msg, r->outs[i]);
+    latencyhist(Thrulatency, age);
+}
+
+// Callback from JavaScript when MIDI message is received.  leng is the
+// number of bytes (1 to 3) and age is how many milliseconds ago it
+// arrived.
 // IMPORTANT: Keep this function minimal! Do NOT call mdep_popup() or other
 // complex KeyKit functions from here, as this is called asynchronously from
 // JavaScript and can cause stack corruption with ASYNCIFY.
 EMSCRIPTEN_KEEPALIVE
-void mdep_on_midi_message(int device_index, int status, int data1, int data2)
+void mdep_on_midi_message(int device_index, int status, int data1, int data2, int leng, int age)
 {
-    // Simply add MIDI bytes to buffer - no complex operations
-    if (midi_buffer_count + 3 <= MIDI_BUFFER_SIZE) {
-        midi_input_buffer[midi_buffer_write_pos++] = (unsigned char)status;
-        if (midi_buffer_write_pos >= MIDI_BUFFER_SIZE)
-            midi_buffer_write_pos = 0;
+    MidiInEvent *e;
 
-        midi_input_buffer[midi_buffer_write_pos++] = (unsigned char)data1;
-        if (midi_buffer_write_pos >= MIDI_BUFFER_SIZE)
-            midi_buffer_write_pos = 0;
+    if (leng < 1 || leng > 3)
+        return;
+    if (midi_thru_types != 0)
+        midi_thru(device_index, status, data1, data2, leng, age);
+    e = midi_event_put(device_index, leng, age);
+    if (e == NULL)
+        return;
+    e->data[0] = (unsigned char)status;
+    e->data[1] = (unsigned char)data1;
+    e->data[2] = (unsigned char)data2;
+}
 
-        midi_input_buffer[midi_buffer_write_pos++] = (unsigned char)data2;
-        if (midi_buffer_write_pos >= MIDI_BUFFER_SIZE)
-            midi_buffer_write_pos = 0;
+// Callback from JavaScript for MIDI messages longer than 3 bytes (sysex).
+// The same restrictions as mdep_on_midi_message() apply.
+EMSCRIPTEN_KEEPALIVE
+void mdep_on_midi_sysex(int device_index, unsigned char *data, int leng, int age)
+{
+    int i;
 
-        midi_buffer_count += 3;
-        midi_messages_received++; // Count messages for debugging
+    if (leng <= 0)
+        return;
+    if (midi_sysex_count + leng > MIDI_SYSEX_RING_SIZE) {
+        midi_messages_dropped++;
+        return;
+    }
+    if (midi_event_put(device_index, leng, age) == NULL)
+        return;
+    for (i = 0; i < leng; i++) {
+        midi_sysex_ring[midi_sysex_write_pos++] = data[i];
+        if (midi_sysex_write_pos >= MIDI_SYSEX_RING_SIZE)
+            midi_sysex_write_pos = 0;
     }
+    midi_sysex_count += leng;
+    if (midi_sysex_count > midi_sysex_highwater)
+        midi_sysex_highwater = midi_sysex_count;
 }
 
 // The value of mouse_buttons from Javascript
@@ -539,42 +655,54 @@ void mdep_clear_mouse_events(void)
     mouse_buffer_count = 0;
 }
 
+// Read the next incoming MIDI message, and the input device and time
+// (in mdep_milliclock() terms) it came from.  Messages from different
+// devices are never mixed in one read.  If a message doesn't fit in
+// buff, the rest of it is returned by the following reads.
 int
-mdep_getnmidi(char *buff, int buffsize, int *port)
+mdep_getnmidiat(char *buff, int buffsize, int *port, long *tm)
 {
-    // Read MIDI data from buffer
-    int bytes_read = 0;
-    int initial_count = midi_buffer_count;
+    MidiInEvent *e;
+    int n, i;
 
-    while (bytes_read < buffsize && midi_buffer_count > 0) {
-        buff[bytes_read++] = midi_input_buffer[midi_buffer_read_pos++];
-        if (midi_buffer_read_pos >= MIDI_BUFFER_SIZE)
-            midi_buffer_read_pos = 0;
-        midi_buffer_count--;
-    }
+    if (midi_event_count <= 0)
+        return 0;
 
+    e = &midi_event_ring[midi_event_read_pos];
     if (port)
-        *port = 0; // Default to first port
-
-    // Debug logging for MIDI input reads
-    static int last_log_count = 0;
-    if (bytes_read > 0) {
-        printf("[MIDI READ] Read %d bytes from buffer (buffer had %d, now has %d, total received: %d)\n",
-               bytes_read, initial_count, midi_buffer_count, midi_messages_received);
-        printf("[MIDI READ] Data: ");
-        for (int i = 0; i < bytes_read && i < 16; i++) {
-            printf("0x%02x ", (unsigned char)buff[i]);
+        *port = e->port;
+    if (tm)
+        *tm = e->tm;
+
+    n = e->leng - midi_event_partial;
+    if (n > buffsize)
+        n = buffsize;
+    if (e->leng <= 3) {
+        for (i = 0; i < n; i++)
+            buff[i] = e->data[midi_event_partial + i];
+    } else {
+        for (i = 0; i < n; i++) {
+            buff[i] = midi_sysex_ring[midi_sysex_read_pos++];
+            if (midi_sysex_read_pos >= MIDI_SYSEX_RING_SIZE)
+                midi_sysex_read_pos = 0;
         }
-        printf("\n");
-        last_log_count = midi_messages_received;
-    } else if (midi_messages_received > last_log_count && (midi_messages_received % 10) == 0) {
-        // Log every 10 messages when we're receiving but not reading
-        printf("[MIDI DEBUG] Received %d messages, buffer count: %d (nothing being read!)\n",
-               midi_messages_received, midi_buffer_count);
-        last_log_count = midi_messages_received;
+        midi_sysex_count -= n;
     }
 
-    return bytes_read;
+    midi_event_partial += n;
+    if (midi_event_partial >= e->leng) {
+        midi_event_partial = 0;
+        if (++midi_event_read_pos >= MIDI_EVENT_RING_SIZE)
+            midi_event_read_pos = 0;
+        midi_event_count--;
+    }
+    return n;
+}
+
+int
+mdep_getnmidi(char *buff, int buffsize, int *port)
+{
+    return mdep_getnmidiat(buff, buffsize, port, NULL);
 }
 
 void
@@ -583,20 +711,66 @@ mdep_putnmidi(int n, char *cp, Midiport *pport)
     // Send MIDI data via Web MIDI API
     if (pport && pport->opened && pport->private1 >= 0) {
         int device_index = pport->private1;
-        js_send_midi_output(device_index, (unsigned char*)cp, n);
+        js_send_midi_output(device_index, (unsigned char*)cp, n, 0);
+    }
+}
+
+// Send MIDI data at time tm (in mdep_milliclock() terms), using
+// the timestamp argument of the Web MIDI send().
+void
+mdep_putnmidiat(int n, char *cp, Midiport *pport, long tm)
+{
+    if (pport && pport->opened && pport->private1 >= 0) {
+        int device_index = pport->private1;
+        long delay = tm - mdep_milliclock();
+        if (delay < 0)
+            delay = 0;
+        js_send_midi_output(device_index, (unsigned char*)cp, n, (int)delay);
     }
 }
 
+// Set the types of channel message (bit 1<<(status>>4)) that are
+// echoed by midi_thru(), or 0 to turn it off.
+void
+mdep_midithru(int types)
+{
+    midi_thru_types = types;
+}
+
+// Set where midi_thru() sends messages from an input port on channel
+// chan (0-based), and how much it offsets the pitch of notes.
+void
+mdep_midithruroute(Midiport *in, int chan, int nouts, Midiport **outs, int offset)
+{
+    MidiThruRoute *r;
+    int i;
+
+    if (in == NULL || in->private1 < 0 || in->private1 >= MIDI_IN_DEVICES)
+        return;
+    if (chan < 0 || chan >= 16)
+        return;
+    r = &midi_thru_routes[in->private1][chan];
+    if (nouts > MIDI_THRU_OUTS)
+        nouts = MIDI_THRU_OUTS;
+    for (i = 0; i < nouts; i++)
+        r->outs[i] = outs[i];
+    r->nouts = nouts;
+    r->offset = offset;
+}
+
 int
 mdep_initmidi(Midiport *inputs, Midiport *outputs)
 {
     int i;
 
-    // Clear MIDI buffer
-    midi_buffer_read_pos = 0;
-    midi_buffer_write_pos = 0;
-    midi_buffer_count = 0;
-    midi_messages_received = 0;
+    // Clear MIDI input rings
+    midi_event_read_pos = 0;
+    midi_event_write_pos = 0;
+    midi_event_count = 0;
+    midi_event_partial = 0;
+    midi_sysex_read_pos = 0;
+    midi_sysex_write_pos = 0;
+    midi_sysex_count = 0;
 
     // Get MIDI device counts (devices are already enumerated in preRun)
     int num_inputs = js_get_midi_input_count();
@@ -650,6 +824,7 @@ void
 mdep_endmidi(void)
 {
     // Cleanup MIDI resources
+    midi_thru_types = 0;
     printf("Ending MIDI...\n");
 }
 
@@ -728,11 +903,30 @@ mdep_mdep(int argc)
 	 *     priority low/normal/high/realtime
 	 *     popen {cmd} "rt"
 	 *     popen {cmd} "wt" {string-to-write}
+	 *     midiinput stats
+	 *     midiinput reset
 	 */
 
 	if ( strcmp(args[0],"midi")==0 ) {
 		execerror("mdep(\"midi\",...) is no longer used.  Use midi(...).\n");
 	}
+	else if ( strcmp(args[0],"midiinput") == 0 ) {
+	    if ( strcmp(args[1],"stats")==0 ) {
+		d = newarrdatum(0,3);
+		setarraydata(d.u.arr,strdatum(uniqstr("received")),numdatum(midi_messages_received));
+		setarraydata(d.u.arr,strdatum(uniqstr("dropped")),numdatum(midi_messages_dropped));
+		setarraydata(d.u.arr,strdatum(uniqstr("queued")),numdatum(midi_event_count));
+		setarraydata(d.u.arr,strdatum(uniqstr("highwater")),numdatum(midi_event_highwater));
+		setarraydata(d.u.arr,strdatum(uniqstr("sysexhighwater")),numdatum(midi_sysex_highwater));
+	    } else if ( strcmp(args[1],"reset")==0 ) {
+		midi_messages_received = 0;
+		midi_messages_dropped = 0;
+		midi_event_highwater = midi_event_count;
+		midi_sysex_highwater = midi_sysex_count;
+	    } else {
+		execerror("mdep(\"midiinput\",... ) doesn't recognize %s\n",args[1]);
+	    }
+	}
 	else if ( strcmp(args[0],"env") == 0 ) {
 	    if ( strcmp(args[1],"get")==0 ) {
 			char *s = getenv(args[2]);
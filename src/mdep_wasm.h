@@ -85,7 +85,11 @@ void mdep_resetclock(void);
 
 // MIDI functions
 int mdep_getnmidi(char *buff, int buffsize, int *port);
+int mdep_getnmidiat(char *buff, int buffsize, int *port, long *tm);
 void mdep_putnmidi(int n, char *cp, struct Midiport_struct *pport);
+void mdep_putnmidiat(int n, char *cp, struct Midiport_struct *pport, long tm);
+void mdep_midithru(int types);
+void mdep_midithruroute(struct Midiport_struct *in, int chan, int nouts, struct Midiport_struct **outs, int offset);
 int mdep_initmidi(struct Midiport_struct *inputs, struct Midiport_struct *outputs);
 void mdep_endmidi(void);
 int mdep_midi(int openclose, struct Midiport_struct *p);
@@ -377,6 +377,7 @@ putnfree(void)
 	Noteptr n = firstnote(Noteq);
 	Noteptr nxt = nextnote(n);
 
+	phchanged(Noteq);
 	setfirstnote(Noteq) = nxt; 	/* remove from list */
 	if ( n == lastnote(Noteq) )
 		lastnote(Noteq) = nxt;
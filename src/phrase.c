@@ -26,6 +26,13 @@ Phrasep Freeph = NULL;		/* Free list, available for re-use by newph() */
 int Numnotes = 0;	/* Total number of notes in use. */
 int Numalloc = 0;	/* Total number of notes that have been allocated. */
 
+/* How often phrases about to be changed had to be copied (see phcow) */
+long Cowcopies = 0;	/* phrases copied because something else uses them */
+long Cownotes = 0;	/* notes in those phrases */
+long Cowinplace = 0;	/* phrases changed in place, without a copy */
+long Newnotes = 0;	/* calls to newnt() */
+long Newphrases = 0;	/* calls to newph() */
+
 #ifdef OLDSTUFF
 void
 countnotes(void)
@@ -109,6 +116,8 @@ newnt(void)
 
 	/* First check the free list and use those nodes, before using */
 	/* the newly allocated stuff. */
+	if ( Freent == NULL )
+		reclaimnotes((long)ALLOCNT);	/* notes queued by phcheck() */
 	if ( Freent != NULL ) {
 		n = Freent;
 		Freent = Freent->next;
@@ -124,44 +133,114 @@ newnt(void)
     getout:
 	n->next = NULL;
 #ifdef NTATTRIB
-	n->attrib = Nullstr;
+	n->hasattrib = 0;
 #endif
 	n->flags = 0;
 	Numnotes++;
+	Newnotes++;
 	return(n);
 }
 
+/*
+ * Messages (for NT_BYTES notes) come from slabs, in a few size classes
+ * that each have their own free list, so a sysex-heavy phrase doesn't
+ * need two kmalloc()s and two kfree()s per note.  Only messages too big
+ * for the largest class get a kmalloc() of their own.
+ */
+#define MESSCLASSES 9
+#define MESSMINSIZE 16		/* block size of the smallest class */
+#define MESSSLAB 4096		/* bytes kmalloc'ed at a time for a class, */
+#define MESSMINBLOCKS 8		/* or this many blocks if that's more */
+#define messsize(leng) (sizeof(Midimessdata)+(leng))
+
+static Midimessp Freemess[MESSCLASSES];
+static Unchar *Messslab[MESSCLASSES];
+static int Messleft[MESSCLASSES];	/* blocks left in Messslab[] */
+long Nmessages = 0;		/* messages in use */
+long Messallocs = 0;		/* kmalloc()s done for messages */
+
+static int
+messclass(int leng)
+{
+	int k;
+	unsigned long sz = MESSMINSIZE;
+
+	for ( k=0; k<MESSCLASSES; k++,sz*=2 ) {
+		if ( messsize(leng) <= sz )
+			return k;
+	}
+	return -1;
+}
+
 Midimessp
 savemess(Unchar* mess,int leng)
 {
 	Midimessp m;
 	register Unchar *p, *q;
 	register int n;
+	int k = messclass(leng);
 
-	m = (Midimessp) kmalloc(sizeof(Midimessdata),"savemess");
+	if ( k < 0 ) {
+		m = (Midimessp) kmalloc(messsize(leng),"savemess");
+		Messallocs++;
+	}
+	else if ( Freemess[k] != NULL ) {
+		m = Freemess[k];
+		/* free blocks hold the next one in their first bytes */
+		Freemess[k] = *((Midimessp *)m);
+	}
+	else {
+		if ( Messleft[k] == 0 ) {
+			Messleft[k] = MESSSLAB / (MESSMINSIZE<<k);
+			if ( Messleft[k] < MESSMINBLOCKS )
+				Messleft[k] = MESSMINBLOCKS;
+			Messslab[k] = (Unchar*) kmalloc(Messleft[k]*(MESSMINSIZE<<k),"savemess");
+			Messallocs++;
+		}
+		m = (Midimessp) Messslab[k];
+		Messslab[k] += (MESSMINSIZE<<k);
+		Messleft[k]--;
+	}
 	m->leng = leng;
-	m->bytes = (Unchar*) kmalloc((unsigned)leng,"savebytes");
 	p = m->bytes;
 	q = mess;
 	for ( n=0; n<leng; n++ )
 		*p++ = *q++;
+	Nmessages++;
 	return(m);
 }
 
+static void
+freemess(Midimessp m)
+{
+	int k;
+
+	if ( m == NULL )
+		return;
+	k = messclass(m->leng);
+	if ( k < 0 )
+		kfree(m);
+	else {
+		*((Midimessp *)m) = Freemess[k];
+		Freemess[k] = m;
+	}
+	Nmessages--;
+}
+
 /*
  * Add a node to the free list
  */
 void
 ntfree(Noteptr n)
 {
-        register Midimessp m;
-
 	if ( n == NULL )
 		return;
+#ifdef NTATTRIB
+	if ( n->hasattrib )
+		ntsetattrib(n,Nullstr);
+#endif
         if ( typeof(n) == NT_BYTES ) {
-                m = messof(n);
-                kfree(m->bytes);
-                kfree(m);
+                freemess(messof(n));
                 /* make sure we can't try to free it again */
                 messof(n) = NULL;
         }
@@ -170,16 +249,136 @@ ntfree(Noteptr n)
 	Numnotes--;
 }
 
-Noteptr 
-ntcopy(register Noteptr n)
+#ifdef NTATTRIB
+/*
+ * Note attributes live in a hash table keyed on the address of the
+ * note, and only notes with hasattrib set have an entry in it.  A note
+ * that doesn't come from newnt() (e.g. the ones in real.c's queue) may
+ * have hasattrib set without an entry, which reads as Nullstr.
+ */
+typedef struct Ntattr {
+	Noteptr nt;
+	char *attrib;
+	struct Ntattr *next;
+} Ntattr;
+
+static Ntattr **Attrtab = NULL;
+static long Attrtabsize = 0;	/* a power of 2 */
+static Ntattr *Freeattr = NULL;
+long Nattribs = 0;		/* number of entries in Attrtab */
+
+#define attrhash(n,sz) ((((unsigned long)(intptr_t)(n))/sizeof(Notedata))&((sz)-1))
+
+static Ntattr **
+attrlookup(Noteptr n)
+{
+	register Ntattr **pa;
+
+	if ( Attrtab == NULL )
+		return(NULL);
+	for ( pa=&Attrtab[attrhash(n,Attrtabsize)]; *pa!=NULL; pa=&((*pa)->next) ) {
+		if ( (*pa)->nt == n )
+			return(pa);
+	}
+	return(NULL);
+}
+
+static void
+attrgrow(void)
+{
+	Ntattr **newtab, *a, *nexta;
+	long newsize, i, h;
+
+	newsize = (Attrtabsize==0) ? 256 : Attrtabsize*2;
+	newtab = (Ntattr **) kmalloc(newsize*sizeof(Ntattr *),"attrgrow");
+	for ( i=0; i<newsize; i++ )
+		newtab[i] = NULL;
+	for ( i=0; i<Attrtabsize; i++ ) {
+		for ( a=Attrtab[i]; a!=NULL; a=nexta ) {
+			nexta = a->next;
+			h = attrhash(a->nt,newsize);
+			a->next = newtab[h];
+			newtab[h] = a;
+		}
+	}
+	if ( Attrtab != NULL )
+		kfree(Attrtab);
+	Attrtab = newtab;
+	Attrtabsize = newsize;
+}
+
+char *
+ntattrib(Noteptr n)
+{
+	Ntattr **pa = attrlookup(n);
+
+	return( pa==NULL ? Nullstr : (*pa)->attrib );
+}
+
+void
+ntsetattrib(Noteptr n,char *att)
+{
+	Ntattr **pa, *a;
+
+	if ( att == NULL || att == Nullstr ) {
+		if ( n->hasattrib ) {
+			if ( (pa=attrlookup(n)) != NULL ) {
+				a = *pa;
+				*pa = a->next;
+				a->next = Freeattr;
+				Freeattr = a;
+				Nattribs--;
+			}
+			n->hasattrib = 0;
+		}
+		return;
+	}
+	if ( n->hasattrib && (pa=attrlookup(n)) != NULL ) {
+		(*pa)->attrib = att;
+		return;
+	}
+	if ( Nattribs >= Attrtabsize )
+		attrgrow();
+	if ( Freeattr != NULL ) {
+		a = Freeattr;
+		Freeattr = a->next;
+	}
+	else
+		a = (Ntattr *) kmalloc(sizeof(Ntattr),"ntsetattrib");
+	a->nt = n;
+	a->attrib = att;
+	pa = &Attrtab[attrhash(n,Attrtabsize)];
+	a->next = *pa;
+	*pa = a;
+	Nattribs++;
+	n->hasattrib = 1;
+}
+#endif
+
+/* Call f with each attribute in use, for strsweep() */
+void
+attribvisit(STRFUNC f)
+{
+#ifdef NTATTRIB
+	register Ntattr *a;
+	long i;
+
+	for ( i=0; i<Attrtabsize; i++ ) {
+		for ( a=Attrtab[i]; a!=NULL; a=a->next )
+			(*f)(a->attrib);
+	}
+#endif
+	(*f)(Defatt);
+}
+
+static void
+ntcopyfields(register Noteptr nn,register Noteptr n)
 {
-	register Noteptr nn;
 	int i, nb;
 
-	nn = newnt();
 	timeof(nn) = timeof(n);
 #ifdef NTATTRIB
-	attribof(nn) = attribof(n);
+	ntsetattrib(nn,attribof(n));
 #endif
 	flagsof(nn) = flagsof(n);
 	portof(nn) = portof(n);
@@ -199,10 +398,33 @@ ntcopy(register Noteptr n)
 		durof(nn) = durof(n);
 		break;
 	}
+}
+
+Noteptr 
+ntcopy(register Noteptr n)
+{
+	register Noteptr nn;
+
+	nn = newnt();
+	ntcopyfields(nn,n);
 	nextnote(nn) = NULL;
 	return(nn);
 }
 
+/*
+ * ntreplace(nn,n)
+ *
+ * Make nn (which is in use) a copy of n, keeping its place in the list.
+ */
+
+void
+ntreplace(Noteptr nn,Noteptr n)
+{
+	if ( typeof(nn) == NT_BYTES )
+		freemess(messof(nn));
+	ntcopyfields(nn,n);
+}
+
 /* freents(n) - works even if n==NULL to begin with */
 void
 freents(Noteptr n)
@@ -379,11 +601,13 @@ ntcmpxact(register Noteptr n1,register Noteptr n2)
 	return 0;
 }
 
-void
+long
 phcopy(Phrasep out,Phrasep in)
 {
 	register Noteptr n, newn, lastn;
+	long cnt = 0;
 
+	phchanged(out);
 	lastn = NULL;
 	out->p_leng = in->p_leng;
 	for ( n=firstnote(in); n!=NULL; n=nextnote(n) ) {
@@ -393,10 +617,105 @@ phcopy(Phrasep out,Phrasep in)
 		else
 			lastn->next = newn;
 		lastn = newn;
+		cnt++;
 		chkrealoften();
 	}
 	out->p_end = lastn;
+	return cnt;
+}
+
+/*
+ * phcow(p,maxused,inituse)
+ *
+ * Called before changing a phrase.  If p isn't used by more than
+ * maxused things, it's returned so it can be changed in place,
+ * otherwise it's copied, and the copy (with an initial usage count
+ * of inituse) is returned.  Either way is counted, for phrasestats().
+ */
+
+Phrasep
+phcow(Phrasep p,int maxused,int inituse)
+{
+	Phrasep np;
+
+	if ( phreallyused(p) <= maxused ) {
+		Cowinplace++;
+		return p;
+	}
+	np = newph(inituse);
+	Cownotes += phcopy(np,p);
+	Cowcopies++;
+	return np;
+}
+
+/*
+ * ntmergelist
+ *
+ * Merge two lists of notes that are each in the proper order.
+ * Notes in list a come first, when they compare equal.
+ */
+
+Noteptr
+ntmergelist(Noteptr a,Noteptr b)
+{
+	Noteptr r = NULL;
+	Noteptr *pp = &r;
+
+	while ( a!=NULL && b!=NULL ) {
+		if ( ntcmporder(a,b) <= 0 ) {
+			*pp = a;
+			pp = &nextnote(a);
+			a = nextnote(a);
+		}
+		else {
+			*pp = b;
+			pp = &nextnote(b);
+			b = nextnote(b);
+		}
+	}
+	*pp = (a!=NULL) ? a : b;
+	return r;
+}
+
+#define NTSORTLEVELS 32
+
+/*
+ * ntsortlist
+ *
+ * Sort a list of notes into the proper order, keeping notes
+ * that compare equal in the order they were in.  This is a
+ * bottom-up merge sort, so it's O(n log n) however bad the
+ * order is to begin with.
+ */
+
+Noteptr
+ntsortlist(Noteptr n)
+{
+	Noteptr level[NTSORTLEVELS];	/* level[i] has 2^i notes, or none */
+	Noteptr nxt, carry;
+	int i;
 
+	for ( i=0; i<NTSORTLEVELS; i++ )
+		level[i] = NULL;
+	for ( ; n!=NULL; n=nxt ) {
+		nxt = nextnote(n);
+		nextnote(n) = NULL;
+		carry = n;
+		for ( i=0; level[i]!=NULL; i++ ) {
+			/* level[i] came earlier, so it goes first */
+			carry = ntmergelist(level[i],carry);
+			level[i] = NULL;
+			if ( i == NTSORTLEVELS-1 )
+				break;
+		}
+		level[i] = carry;
+	}
+	carry = NULL;
+	for ( i=0; i<NTSORTLEVELS; i++ ) {
+		if ( level[i] != NULL )
+			carry = ntmergelist(level[i],carry);
+	}
+	return carry;
 }
 
 /*
@@ -407,46 +726,30 @@ phcopy(Phrasep out,Phrasep in)
  */
 
 void
-phreorder(Phrasep ph,long tmout)
+phreorder(Phrasep ph)
 {
 	register Noteptr n, nextn;
-	int cnt = 0;
 
-	/* Since we're re-ordering, we can't trust p_end, so we */
-	/* have to make sure ntinsert() doesn't use it. */
-	lastnote(ph) = NULL;
+	phchanged(ph);
 
-	for ( n=firstnote(ph); n!=NULL; ) {
-		if ( tmout > 0 && ++cnt > 100 ) {
-			cnt = 0;
-			if ( MILLICLOCK >= tmout ) {
-				FILE *tf = fopen("tmp.phrase","w");
-				eprint("Warning, phreorder timed out!!\n");
-#ifdef DONTDO
-				tmout += 30000;
-				for ( n=firstnote(ph);n!=NULL;n=n->next ) {
-					fprintf(tf,"n=%ld,tm=%ld\n",(long)n,timeof(n));
-					if ( MILLICLOCK >= tmout ) {
-						fprintf(tf,"TIMEOUT!?\n");
-						break;
-					}
-				}
-#endif
-				myfclose(tf);
-				return;
-			}
-		}
-		if ( (nextn=n->next) == NULL )
+	n = firstnote(ph);
+	if ( n == NULL ) {
+		ph->p_end = NULL;
+		return;
+	}
+	/* Usually it's in order already, or nearly so, */
+	/* so find the first note that's out of order. */
+	for ( ; (nextn=nextnote(n)) != NULL; n=nextn ) {
+		if ( ntcmporder(n,nextn) > 0 )
 			break;
-		if ( ntcmporder(n,nextn) <= 0 ) {
-			n = nextn;	/* order is okay */
-		}
-		else {
-			/* nextn is out of order, so delete and re-insert */
-			n->next = nextn->next;
-			ntinsert(nextn,ph);
-			/* don't advance n */
-		}
+	}
+	if ( nextn != NULL ) {
+		/* Sort the rest (stably, like the insertion sort this */
+		/* used to be) and merge it with the part that's in order. */
+		nextnote(n) = NULL;
+		setfirstnote(ph) = ntmergelist(firstnote(ph),ntsortlist(nextn));
+		for ( n=firstnote(ph); nextnote(n)!=NULL; n=nextnote(n) )
+			;
 	}
 	ph->p_end = n;
 }
@@ -506,6 +809,99 @@ phcutchannel(Phrasep pin,Phrasep pout,int chan)
 	}
 }
 
+/*
+ * phindex
+ *
+ * Return a phrase's time index, building it if it doesn't exist yet.
+ * The index is an array with one entry per note, in order, so that
+ * picknt() can go straight to a note and the phcut*() functions can
+ * binary search for the start of a time range, rather than walking
+ * the list from the start.  Phrases with fewer than Phindexmin notes,
+ * and phrases that aren't in time order (like Current), don't get one,
+ * and NULL is returned.  The index is thrown away by phchanged().
+ */
+
+Ntindex *
+phindex(Phrasep p)
+{
+	register Noteptr n, nxt;
+	register Ntindex *ix;
+	long cnt, e, maxend;
+
+	if ( p->p_index != NULL )
+		return p->p_index;
+	if ( *Phindexmin <= 0 )
+		return NULL;
+	cnt = 0;
+	for ( n=firstnote(p); n!=NULL; n=nxt ) {
+		nxt = nextnote(n);
+		if ( nxt != NULL && timeof(nxt) < timeof(n) )
+			return NULL;
+		cnt++;
+	}
+	if ( cnt < *Phindexmin )
+		return NULL;
+
+	ix = (Ntindex *) kmalloc((unsigned)(cnt*sizeof(Ntindex)),"phindex");
+	maxend = 0;
+	for ( cnt=0,n=firstnote(p); n!=NULL; cnt++,n=nextnote(n) ) {
+		/* zero-length things are treated as 1 click long by */
+		/* the phcut*() functions */
+		e = endof(n);
+		if ( e == timeof(n) )
+			e++;
+		if ( cnt == 0 || e > maxend )
+			maxend = e;
+		ix[cnt].clicks = timeof(n);
+		ix[cnt].maxend = maxend;
+		ix[cnt].nt = n;
+	}
+	p->p_index = ix;
+	p->p_nindex = cnt;
+	return ix;
+}
+
+void
+phunindex(Phrasep p)
+{
+	kfree(p->p_index);
+	p->p_index = NULL;
+	p->p_nindex = 0;
+}
+
+/* Return the position of the first note in an index at or after tm */
+static long
+ixfindtime(Ntindex *ix,long cnt,long tm)
+{
+	long lo = 0, hi = cnt, mid;
+
+	while ( lo < hi ) {
+		mid = lo + (hi-lo)/2;
+		if ( ix[mid].clicks < tm )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* Return the position of the first note in an index that might */
+/* still be sounding after tm - none of the notes before it are. */
+static long
+ixfindend(Ntindex *ix,long cnt,long tm)
+{
+	long lo = 0, hi = cnt, mid;
+
+	while ( lo < hi ) {
+		mid = lo + (hi-lo)/2;
+		if ( ix[mid].maxend <= tm )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
 /*
  * All of the phcut*() functions have the following semantics:
  * the time period of the cut starts at tm1 and ends at (but does NOT
@@ -518,9 +914,21 @@ phcut(Phrasep pin,Phrasep pout,long tm1,long tm2,int p1,int p2)
 {
 	register Noteptr n;
 	register long t;
+	Ntindex *ix;
+	long i;
 
 	if ( tm1 == tm2 )
 		tm2 = tm1 + 1;
+	if ( (ix=phindex(pin)) != NULL ) {
+		for ( i=ixfindtime(ix,pin->p_nindex,tm1); i<pin->p_nindex; i++ ) {
+			if ( ix[i].clicks >= tm2 )
+				break;
+			n = ix[i].nt;
+			if ( !ntisnote(n) || ((int)pitchof(n)>=p1&&(int)pitchof(n)<=p2) )
+				ntinsert(ntcopy(n),pout);
+		}
+		return;
+	}
 	for ( n=firstnote(pin); n!=NULL; n=nextnote(n) ) {
 		t = timeof(n);
 		if ( t >= tm1 && t<tm2 &&
@@ -535,11 +943,21 @@ phcutincl(Phrasep pin,Phrasep pout,long tm1,long tm2)
 {
 	register Noteptr n;
 	register long t, e;
+	Ntindex *ix;
+	long i;
 
 	if ( tm1 == tm2 )
 		tm2 = tm1 + 1;
-	for ( n=firstnote(pin); n!=NULL; n=nextnote(n) ) {
+	n = firstnote(pin);
+	if ( (ix=phindex(pin)) != NULL ) {
+		i = ixfindend(ix,pin->p_nindex,tm1);
+		n = (i < pin->p_nindex) ? ix[i].nt : NULL;
+	}
+	for ( ; n!=NULL; n=nextnote(n) ) {
 		t = timeof(n);
+		/* nothing after this can be in the range */
+		if ( ix != NULL && t > tm1 && t >= tm2 )
+			break;
 		e = endof(n);
 		if ( t == e )
 			e = t + 1;
@@ -555,11 +973,21 @@ phcuttrunc(Phrasep pin,Phrasep pout,long tm1,long tm2)
 	Noteptr n, newn;
 	long prehang, overhang;
 	long t, e;
+	Ntindex *ix;
+	long i;
 
 	if ( tm1 == tm2 )
 		tm2 = tm1 + 1;
-	for ( n=firstnote(pin); n!=NULL; n=nextnote(n) ) {
+	n = firstnote(pin);
+	if ( (ix=phindex(pin)) != NULL ) {
+		i = ixfindend(ix,pin->p_nindex,tm1);
+		n = (i < pin->p_nindex) ? ix[i].nt : NULL;
+	}
+	for ( ; n!=NULL; n=nextnote(n) ) {
 		t = timeof(n);
+		/* nothing after this can be in the range */
+		if ( ix != NULL && t >= tm2 )
+			break;
 		e = endof(n);
 		if ( t == e )
 			e = t + 1;
@@ -616,6 +1044,7 @@ newph(int inituse)
 getout:
 	reinitph(p);
 	p->p_used = inituse;
+	Newphrases++;
 	/* Topph is the list of phrases in use */
 	p->p_next = Topph;
 	p->p_prev = NULL;
@@ -628,38 +1057,156 @@ getout:
 void
 reinitph(register Phrasep p)
 {
+	phchanged(p);
 	p->p_notes = NULL;
 	p->p_end = NULL;
 	p->p_leng = 0L;
 	p->p_used = 0;
 	p->p_tobe = 0;
+	p->p_state = 0;
 }
 
 /*
- * ntinsert(n,p)
+ * phladder
  *
- * Insert a note into a phrase, using the note's
- * time (clicks) to determine where it goes.
+ * Build a phrase's ladder, which holds every LADDERSTEP'th note.
+ * Adding notes doesn't invalidate it, it just makes the rungs further
+ * apart, so it only needs rebuilding now and then.  Notes added after
+ * the last rung get new rungs of their own (see phladdertail).
  */
 
+static void
+phladder(Phrasep p)
+{
+	register Noteptr n;
+	long cnt, k;
+
+	if ( p->p_ladder != NULL )
+		phunladder(p);
+	cnt = 0;
+	for ( n=firstnote(p); n!=NULL; n=nextnote(n) )
+		cnt++;
+	cnt = (cnt+LADDERSTEP-1) / LADDERSTEP;
+	if ( cnt == 0 )
+		return;
+	p->p_ladder = (Noteptr *) kmalloc((unsigned)(cnt*sizeof(Noteptr)),"phladder");
+	for ( k=0,cnt=0,n=firstnote(p); n!=NULL; k++,n=nextnote(n) ) {
+		if ( (k % LADDERSTEP) == 0 )
+			p->p_ladder[cnt++] = n;
+	}
+	p->p_nladder = cnt;
+	p->p_mladder = cnt;
+	p->p_ntail = (k-1) % LADDERSTEP;
+	p->p_ninserts = 0;
+}
+
+/*
+ * phladdertail
+ *
+ * Called when a note has been added after the last rung of the ladder.
+ * Once there are LADDERSTEP notes after it, the next one becomes a
+ * new rung, so a phrase that keeps growing at the end (as when it's
+ * built with quantize or "r |= nt") doesn't need its ladder rebuilt.
+ */
+
+static void
+phladdertail(Phrasep p)
+{
+	register Noteptr n;
+	Noteptr *newl;
+	long k;
+
+	if ( ++(p->p_ntail) < LADDERSTEP )
+		return;
+	n = p->p_ladder[p->p_nladder-1];
+	for ( k=0; k<LADDERSTEP; k++ )
+		n = nextnote(n);
+	if ( p->p_nladder >= p->p_mladder ) {
+		newl = (Noteptr *) kmalloc((unsigned)(2*p->p_mladder*sizeof(Noteptr)),"phladdertail");
+		for ( k=0; k<p->p_nladder; k++ )
+			newl[k] = p->p_ladder[k];
+		kfree(p->p_ladder);
+		p->p_ladder = newl;
+		p->p_mladder *= 2;
+	}
+	p->p_ladder[p->p_nladder++] = n;
+	p->p_ntail -= LADDERSTEP;
+}
+
 void
-ntinsert(Noteptr n,Phrasep p)
+phunladder(Phrasep p)
+{
+	kfree(p->p_ladder);
+	p->p_ladder = NULL;
+	p->p_nladder = 0;
+	p->p_mladder = 0;
+	p->p_ntail = 0;
+	p->p_ninserts = 0;
+}
+
+/*
+ * ntplace(n,p,after)
+ *
+ * Insert a note into a phrase, using ntcmporder() to determine where
+ * it goes.  If after is non-zero, it goes after any notes that compare
+ * equal to it, otherwise before them.
+ *
+ * Rather than always searching from the start of the phrase, the search
+ * starts at p_finger (the last note inserted) if n goes after it, so
+ * that building a phrase in order, or with each note a little after
+ * the previous one, is cheap.  If the phrase has a ladder, a binary
+ * search of it finds a place to start that's within a rung or so of
+ * where n goes.  The ladder is built (or rebuilt, once enough notes
+ * have been added that the rungs are far apart) whenever a search
+ * has to walk a long way.
+ */
+
+static void
+ntplace(Noteptr n,Phrasep p,int after)
 {
 	register Noteptr lastn = NULL;
 	register Noteptr prevnt = NULL;
 	register Noteptr nt1;
+	int lim = after ? 0 : -1;
+	long lo, hi, mid, walked;
+	int tail = 0;
+
+	phgrown(p);
 
 	/* quick check to see if it goes at the end */
 	lastn = p->p_end;
-	if ( lastn != NULL && ntcmporder(n,lastn) >= 0 ) {
+	if ( lastn != NULL && ntcmporder(lastn,n) <= lim ) {
 		lastn->next = n;
 		n->next = NULL;
 		p->p_end = n;
+		p->p_finger = n;
+		if ( p->p_ladder != NULL )
+			phladdertail(p);
 		return;
 	}
 
-	nt1 = firstnote(p);
-	while ( nt1!=NULL && ntcmporder(nt1,n) <= 0 ) {
+	/* Any note that n goes after is a fine place to start, */
+	/* the later the better. */
+	if ( p->p_finger != NULL && ntcmporder(p->p_finger,n) <= lim )
+		prevnt = p->p_finger;
+	if ( p->p_ladder != NULL ) {
+		/* find the last rung that n goes after */
+		lo = 0;
+		hi = p->p_nladder;
+		while ( lo < hi ) {
+			mid = lo + (hi-lo)/2;
+			if ( ntcmporder(p->p_ladder[mid],n) <= lim )
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		if ( lo > 0 && (prevnt == NULL
+				|| ntcmporder(prevnt,p->p_ladder[lo-1]) < 0) )
+			prevnt = p->p_ladder[lo-1];
+		tail = (lo == p->p_nladder);
+	}
+	nt1 = (prevnt == NULL) ? firstnote(p) : prevnt->next;
+	for ( walked=0; nt1!=NULL && ntcmporder(nt1,n) <= lim; walked++ ) {
 		prevnt = nt1;
 		nt1=nt1->next;
 	}
@@ -670,7 +1217,42 @@ ntinsert(Noteptr n,Phrasep p)
 	n->next = nt1;
 	if ( nt1 == NULL )
 		p->p_end = n;
-/* printf("   after expensive ntinsert, p->first=%ld\n",realfirstnote(p)); */
+	p->p_finger = n;
+
+	if ( tail ) {
+		phladdertail(p);
+		return;
+	}
+	p->p_ninserts++;
+	if ( walked > 2*LADDERSTEP && (p->p_ladder == NULL
+			|| p->p_ninserts > p->p_nladder*LADDERSTEP) )
+		phladder(p);
+}
+
+/*
+ * ntinsert(n,p)
+ *
+ * Insert a note into a phrase, using the note's
+ * time (clicks) to determine where it goes.
+ */
+
+void
+ntinsert(Noteptr n,Phrasep p)
+{
+	ntplace(n,p,1);
+}
+
+/*
+ * ntinsertbefore(n,p)
+ *
+ * Like ntinsert(), but n goes before any notes that compare equal
+ * to it, which is where merging it with phrmerge() would put it.
+ */
+
+void
+ntinsertbefore(Noteptr n,Phrasep p)
+{
+	ntplace(n,p,0);
 }
 
 /*
@@ -684,6 +1266,7 @@ ntdelete(register Phrasep ph,register Noteptr nt)
 {
 	register Noteptr n, pre;
 
+	phchanged(ph);
 	for ( pre=NULL,n=firstnote(ph); n!=NULL; pre=n,n=n->next ) {
 		if ( n == nt )
 			break;
@@ -1277,7 +1860,7 @@ strtont(char *s)
 	flagsof(n) = flags;
 	portof(n) = Defport;
 #ifdef NTATTRIB
-	attribof(n) = att;
+	ntsetattrib(n,att);
 #endif
 
 	return(n);
@@ -1308,7 +1891,7 @@ messtont(char *s)
 	portof(n) = Defport;
 
 #ifdef NTATTRIB
-	attribof(n) = Defatt;
+	ntsetattrib(n,Defatt);
 #endif
 	while ( (c=(*s++)) != '\0' ) {
 		if ( c == 't' ) {
@@ -1327,7 +1910,7 @@ messtont(char *s)
 		if ( c == '`' ) {
 			Defatt = attscan(&s);
 #ifdef NTATTRIB
-			attribof(n) = Defatt;
+			ntsetattrib(n,Defatt);
 #endif
 			continue;
 		}
@@ -1392,7 +1975,7 @@ strtotextmess(char *s)
 	flagsof(n) = Defflags;
 	portof(n) = Defport;
 #ifdef NTATTRIB
-	attribof(n) = Defatt;
+	ntsetattrib(n,Defatt);
 #endif
 	if ( *s == '"' )
 		s++;
@@ -1420,7 +2003,7 @@ strtotextmess(char *s)
 			else if ( c == '`' ) {
 				Defatt = attscan(&s);
 #ifdef NTATTRIB
-				attribof(n) = Defatt;
+				ntsetattrib(n,Defatt);
 #endif
 			}
 			else
@@ -1448,7 +2031,7 @@ ptrtobyte(register Noteptr n,register int num)
 		{
 		m = messof(n);
 
-		if ( m != NULL && m->bytes != NULL && num < m->leng )
+		if ( m != NULL && num < m->leng )
 			return (Unchar*)(&(m->bytes[num]));
 		}
 		break;
@@ -62,7 +62,9 @@
 #define pitchof(nt) ((nt)->u.n.pitch)
 #define volof(nt) ((nt)->u.n.vol)
 #define durof(nt) ((nt)->u.n.duration)
-#define attribof(nt) ((nt)->attrib)
+#ifdef NTATTRIB
+#define attribof(nt) ((nt)->hasattrib?ntattrib(nt):Nullstr)
+#endif
 #define flagsof(nt) ((nt)->flags)
 #define le3_nbytesof(nt) ((nt)->u.b.nbytes)
 #define gt3_nbytesof(nt) ((nt)->u.m->leng)
@@ -77,7 +79,13 @@
 #define firstnote(p) ((p)->p_notes)
 
 /* first-time initialization */
-#define init1ph(p) {(p)->p_prev = NULL;}
+#define init1ph(p) {(p)->p_prev = NULL; (p)->p_index = NULL; (p)->p_ladder = NULL;}
+
+/* Anything that changes the notes (or their order) in a phrase must */
+/* throw away its index, finger, and ladder (see ntinsert()).  Just */
+/* adding notes, in order, only affects the index. */
+#define phgrown(p) {(p)->p_statsok=0;if((p)->p_index!=NULL)phunindex(p);}
+#define phchanged(p) {(p)->p_finger=NULL;phgrown(p);if((p)->p_ladder!=NULL)phunladder(p);}
 
 /* Maximum size of a single note (which is normally small, but for */
 /* quoted strings can be any size) */
@@ -90,18 +98,34 @@
 #define ALLOCPH 128
 #endif
 
-#define DURATIONTYPE long
-#define MAXDURATION (MAXLONG-2)
-#define UNFINISHED_DURATION (MAXLONG-1)
+/* Value of p_state for phrases in the Tobechecked list */
+#define PH_TOBECHECKED 1
+
+/* Spacing of the notes in a phrase's ladder (see ntinsert()) */
+#define LADDERSTEP 32
 
+#define DURATIONTYPE INT32
+#define MAXDURATION (MAXINT32-2)
+#define UNFINISHED_DURATION (MAXINT32-1)
+
+/* The bytes of a message follow its length, in the same block (see */
+/* savemess()), so bytes[] is really leng long. */
 typedef struct Midimessdata {
 	int leng;
-	Unchar* bytes;
+	Unchar bytes[4];
 } Midimessdata;
 
 typedef struct Notedata {
 	Noteptr next;
-	long clicks;	/* # of clicks from start of phrase. */
+	INT32 clicks;	/* # of clicks from start of phrase. */
+	Unchar type:7;	/* NT_NOTE, NT_BYTES, NT_LE3BYTES, NT_ON, NT_OFF */
+#ifdef NTATTRIB
+	/* Attributes are rare, so rather than a pointer in every note, */
+	/* they're kept in a separate table (see ntsetattrib()). */
+	Unchar hasattrib:1;
+#endif
+	Unchar port;
+	UINT16 flags;
 	union {
 		struct {		/* for NT_NOTE, NT_ON, NT_OFF */
 			Unchar chan;
@@ -115,22 +139,47 @@ typedef struct Notedata {
 		} b;
 		Midimessp m;		/* for NT_BYTES */
 	} u;
-	char type;	/* NT_NOTE, NT_BYTES, NT_LE3BYTES, NT_ON, NT_OFF */
-	Unchar port;
-	UINT16 flags;
-#ifdef NTATTRIB
-	char *attrib;
-#endif
 } Notedata;
 
+/* Aggregate values of a phrase, cached by phstats() */
+typedef struct Phstats {
+	long nall;		/* number of notes of any type */
+	long nnotes;		/* number of NT_NOTE, NT_ON, and NT_OFF notes */
+	/* Sums of the values that phdotvalue() averages.  The pitch, */
+	/* vol, and dur sums are only over NT_NOTE/ON/OFF notes. */
+	long sumpitch, sumvol, sumdur;
+	long sumtime, sumchan, sumport, sumflags;
+	/* The values that limitsof() returns */
+	int lowest, highest;
+	long earliest, latest;
+} Phstats;
+
+/* One entry in a phrase's time index (see phindex()) */
+typedef struct Ntindex {
+	long clicks;		/* timeof(nt) */
+	long maxend;		/* latest end of this and all earlier notes */
+	Noteptr nt;
+} Ntindex;
+
 typedef struct Phrase {
 	Noteptr p_notes;
 	Noteptr p_end;		/* last note in phrase */
+	Ntindex *p_index;	/* NULL, or one entry per note, in order */
+	long p_nindex;		/* number of entries in p_index */
+	Noteptr p_finger;	/* NULL, or the last note ntinsert() added */
+	Noteptr *p_ladder;	/* NULL, or every LADDERSTEP'th note, in order */
+	long p_nladder;		/* number of entries in p_ladder */
+	long p_mladder;		/* number of entries allocated */
+	long p_ntail;		/* notes after the last rung of p_ladder */
+	long p_ninserts;	/* ntinsert()s since p_ladder was built */
+	Phstats p_stats;	/* only valid if p_statsok is set */
+	int p_statsok;
 
 	long p_leng;		/* Length in clicks.  If -1, this */
 				/*    is an available (temp) one. */
 	short p_used;		/* Number of things using this phrase */
 	short p_tobe;		/* Pending increment to p_used */
+	short p_state;		/* PH_TOBECHECKED or 0 */
 
 	Phrasep p_next;
 	Phrasep p_prev;
@@ -144,4 +193,8 @@ extern char *Defatt;
 extern UINT16 Defflags;
 extern long Deftime, Def2time;
 extern int Numnotes;
+extern int Numalloc;
+extern long Cowcopies, Cownotes, Cowinplace, Newnotes, Newphrases;
+extern long Nattribs;
+extern long Nmessages, Messallocs;
 extern char *Nullstr;
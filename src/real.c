@@ -11,6 +11,11 @@ int Debugqnote = 0;
 #include "keymidi.h"
 
 static void real_putnmidi(int buffsize, char *buff, int port);
+static void batchmidi(int n, char *msg, int port);
+static void flushbatches(void);
+static void countcutoffs(Unchar *msg);
+static Symlongp Midicutoffcheck;	/* if non-zero, count Midicutoffs */
+static int Batching = 0;	/* if non-zero, midiput() output is batched */
 
 static int Currport = 0;  /* 1-based input port number (keykit's port
                            * numbers), 0 means default. */
@@ -21,13 +26,107 @@ static long lastnowoffset = 0;
 static void put3onmonitorfifo(int c1, int c2, int c3);
 static void putonmonitorfifo(Noteptr n);
 
+/* The schedule of events within realtime() is kept as a binary heap, */
+/* ordered by clicks.  Events scheduled at the same click are kept in */
+/* the order they were scheduled (using the seq value), just as they */
+/* were when the schedule was a sorted list. */
+
+Sched **Schedheap = NULL;
+int Nsched = 0;
+static long Schedheapsize = 0;	/* in bytes, as used by makeroom() */
+static unsigned long Schedseq = 0;
+
+#define schedbefore(a,b) ((a)->clicks<(b)->clicks || \
+	((a)->clicks==(b)->clicks && (long)((a)->seq-(b)->seq)<0))
+
+static void
+schedput(Sched *s, int i)
+{
+	Schedheap[i] = s;
+	s->heapindex = i;
+}
+
+static void
+schedup(int i)
+{
+	Sched *s = Schedheap[i];
+	int parent;
+
+	while ( i > 0 ) {
+		parent = (i-1)/2;
+		if ( ! schedbefore(s,Schedheap[parent]) )
+			break;
+		schedput(Schedheap[parent],i);
+		i = parent;
+	}
+	schedput(s,i);
+}
+
+static void
+scheddown(int i)
+{
+	Sched *s = Schedheap[i];
+	int child;
+
+	while ( (child=2*i+1) < Nsched ) {
+		if ( child+1 < Nsched && schedbefore(Schedheap[child+1],Schedheap[child]) )
+			child++;
+		if ( ! schedbefore(Schedheap[child],s) )
+			break;
+		schedput(Schedheap[child],i);
+		i = child;
+	}
+	schedput(s,i);
+}
+
+/* Add s to the schedule, after anything already at the same click */
+static void
+schedinsert(Sched *s)
+{
+	makeroom((long)((Nsched+1)*sizeof(Sched*)),(char**)(&Schedheap),&Schedheapsize);
+	s->seq = Schedseq++;
+	schedput(s,Nsched++);
+	schedup(s->heapindex);
+}
+
+/* Remove s from the schedule (without freeing it) */
+static void
+schedremove(Sched *s)
+{
+	int i = s->heapindex;
+	Sched *last = Schedheap[--Nsched];
+
+	if ( last != s ) {
+		schedput(last,i);
+		schedup(i);
+		scheddown(last->heapindex);
+	}
+	s->heapindex = -1;
+}
+
+/* The clicks value of s has changed, so move it to its new place, */
+/* after anything already scheduled at that click. */
+static void
+schedmove(Sched *s)
+{
+	s->seq = Schedseq++;
+	schedup(s->heapindex);
+	scheddown(s->heapindex);
+}
+
 void
 chksched(char *str)
 {
-	Sched *s;
-	for ( s=Topsched; s!=NULL; s=s->next ) {
-		if ( s->next != NULL && s->clicks > s->next->clicks )
-			eprint("Sched order: %s %ld %ld\n",str,s->clicks,s->next->clicks);
+	Sched *s, *parent;
+	int n;
+
+	for ( n=1; n<Nsched; n++ ) {
+		s = Schedheap[n];
+		parent = Schedheap[(n-1)/2];
+		if ( schedbefore(s,parent) )
+			eprint("Sched order: %s %ld %ld\n",str,parent->clicks,s->clicks);
+		if ( s->heapindex != n )
+			eprint("Sched index: %s %d %d\n",str,s->heapindex,n);
 	}
 }
 
@@ -35,13 +134,199 @@ void
 psched(void)
 {
 	Sched *s;
+	int n;
+
 	eprint("(sched=");
-	for ( s=Topsched; s!=NULL; s=s->next ) {
+	for ( n=0; n<Nsched; n++ ) {
+		s = Schedheap[n];
 		eprint("(%ld=%lld)",s->clicks,(intptr_t)s);
 	}
 	eprint(";)\n");
 }
 
+/* Note-offs that complete NT_NOTEs are by far the most common scheduled */
+/* events, so they aren't Sched nodes.  Each one is a small record in */
+/* Noteoffpool, whose slots are reused (so playing a note doesn't */
+/* allocate anything), and Noteoffheap is a binary heap of pool slots, */
+/* ordered by clicks.  Note-offs only ever leave the heap from the top, */
+/* so slots don't need to know where they are in it; when a task is */
+/* unscheduled, its note-offs are sent right away and detached from it, */
+/* but stay in the heap until they come due. */
+
+typedef struct Noteoff {
+	long clicks;		/* scheduled time, or next free slot */
+	Ktaskp task;		/* task that played the note, or NULL */
+	int tnext;		/* list of the task's note-offs */
+	int tprev;
+	Unchar port;
+	Unchar chan;		/* 0-15, plus NOFF_MONITOR */
+	Unchar pitch;
+	Unchar vol;
+} Noteoff;
+
+#define NOFF_MONITOR 0x10
+
+static Noteoff *Noteoffpool = NULL;
+static long Noteoffpoolsize = 0;	/* in bytes, as used by makeroom() */
+static int Noteoffslots = 0;		/* number of slots ever used */
+static int Freenoteoff = -1;		/* list of free slots */
+static int *Noteoffheap = NULL;
+static long Noteoffheapsize = 0;	/* in bytes */
+static int Nnoteoff = 0;
+
+#define noteoffat(i) (&Noteoffpool[Noteoffheap[i]])
+
+static void
+noteoffup(int i)
+{
+	int slot = Noteoffheap[i];
+	long clk = Noteoffpool[slot].clicks;
+	int parent;
+
+	while ( i > 0 ) {
+		parent = (i-1)/2;
+		if ( noteoffat(parent)->clicks <= clk )
+			break;
+		Noteoffheap[i] = Noteoffheap[parent];
+		i = parent;
+	}
+	Noteoffheap[i] = slot;
+}
+
+static void
+noteoffdown(int i)
+{
+	int slot = Noteoffheap[i];
+	long clk = Noteoffpool[slot].clicks;
+	int child;
+
+	while ( (child=2*i+1) < Nnoteoff ) {
+		if ( child+1 < Nnoteoff && noteoffat(child+1)->clicks < noteoffat(child)->clicks )
+			child++;
+		if ( noteoffat(child)->clicks >= clk )
+			break;
+		Noteoffheap[i] = Noteoffheap[child];
+		i = child;
+	}
+	Noteoffheap[i] = slot;
+}
+
+/* Schedule a note-off, which is charged to task t */
+static void
+noteoffsched(long clicks, Ktaskp t, int port, int chan, int pitch, int vol, int monitor)
+{
+	Noteoff *no;
+	int slot;
+
+	if ( Freenoteoff >= 0 ) {
+		slot = Freenoteoff;
+		Freenoteoff = (int)(Noteoffpool[slot].clicks);
+	}
+	else {
+		slot = Noteoffslots++;
+		makeroom((long)(Noteoffslots*sizeof(Noteoff)),(char**)(&Noteoffpool),&Noteoffpoolsize);
+		makeroom((long)(Noteoffslots*sizeof(int)),(char**)(&Noteoffheap),&Noteoffheapsize);
+	}
+	no = &Noteoffpool[slot];
+	no->clicks = clicks;
+	no->task = t;
+	no->port = port;
+	no->chan = chan | (monitor?NOFF_MONITOR:0);
+	no->pitch = pitch;
+	no->vol = vol;
+	no->tprev = -1;
+	no->tnext = t->noteoffs;
+	if ( t->noteoffs >= 0 )
+		Noteoffpool[t->noteoffs].tprev = slot;
+	t->noteoffs = slot;
+	t->schedcnt++;
+	Noteoffheap[Nnoteoff] = slot;
+	noteoffup(Nnoteoff++);
+}
+
+/* Take a note-off away from the task that played it. */
+/* This is where the task may finish. */
+static void
+noteoffdetach(int slot)
+{
+	Noteoff *no = &Noteoffpool[slot];
+	Ktaskp t = no->task;
+
+	if ( no->tprev >= 0 )
+		Noteoffpool[no->tprev].tnext = no->tnext;
+	else
+		t->noteoffs = no->tnext;
+	if ( no->tnext >= 0 )
+		Noteoffpool[no->tnext].tprev = no->tprev;
+	no->task = NULL;
+	if ( --(t->schedcnt) <= 0 ) {
+		wakewaiters(t);
+		deletetask(t);
+	}
+}
+
+/* Free a note-off's slot (it must already be out of the heap) */
+static void
+noteofffree(int slot)
+{
+	if ( Noteoffpool[slot].task != NULL )
+		noteoffdetach(slot);
+	Noteoffpool[slot].clicks = Freenoteoff;
+	Freenoteoff = slot;
+}
+
+/* Remove the earliest note-off from the heap, and free it */
+static void
+noteoffpop(void)
+{
+	int slot = Noteoffheap[0];
+
+	if ( --Nnoteoff > 0 ) {
+		Noteoffheap[0] = Noteoffheap[Nnoteoff];
+		noteoffdown(0);
+	}
+	noteofffree(slot);
+}
+
+/* Return the time of the earliest scheduled event of either kind, */
+/* or MAXCLICKS if nothing is scheduled. */
+long
+nextschedtime(void)
+{
+	long clk = MAXCLICKS;
+
+	if ( Nsched > 0 )
+		clk = Schedheap[0]->clicks;
+	if ( Nnoteoff > 0 && noteoffat(0)->clicks < clk )
+		clk = noteoffat(0)->clicks;
+	return clk;
+}
+
+/* Find the time of the earliest event scheduled for task t. */
+/* Returns 0 if it doesn't have any. */
+int
+taskschedtime(Ktaskp t, long *clk)
+{
+	Sched *s;
+	Noteoff *no;
+	int n, found = 0;
+
+	for ( s=t->schedlist; s!=NULL; s=s->tnext ) {
+		if ( found==0 || s->clicks < *clk ) {
+			*clk = s->clicks;
+			found = 1;
+		}
+	}
+	for ( n=t->noteoffs; n>=0; n=no->tnext ) {
+		no = &Noteoffpool[n];
+		if ( found==0 || no->clicks < *clk ) {
+			*clk = no->clicks;
+			found = 1;
+		}
+	}
+	return found;
+}
+
 static char *Grabbuff = NULL;
 static long Grabbuffsize = 0;
 
@@ -61,6 +346,15 @@ long Midimilli = 0;	/* in milliseconds */
 
 long Nextclick = -1;	/* in milliseconds */
 
+/* When Bouncing, MILLICLOCK is a virtual clock (Bounceclock) that */
+/* jumps straight to the next scheduled event whenever no task is */
+/* running, and MIDI output is captured in Bouncephr rather than */
+/* being sent.  See midi("bounce"). */
+int Bouncing = 0;
+long Bounceclock = 0;
+static Phrasep Bouncephr = NULL;
+static long Bouncenow;	/* value of Now when the bounce started */
+
 int Chkmouse = 0;	/* if non-zero, there are mouse actions to be */
 			/* checked. */
 
@@ -85,16 +379,14 @@ static int Grabcnt;	/* used to throttle MIDI input in GRABMIDI */
 #define ISMONITORING (*Monitor_fnum >= 0)
 
 /*
- * midiput
+ * outportof
  *
- * Write n bytes of MIDI output.
- * chan can be -1 if there is none.
+ * Return the (1-based) output port that output on the given port
+ * and channel really goes to, or 0 if it goes nowhere.
  */
-static void
-midiput(int n,Unchar* msg,int port,int chan)
+static int
+outportof(int port,int chan)
 {
-	if ( chan < 0 )
-		chan = 0;
 	/*
 	 * If the port value is one of the input ports,
 	 * then map it to the desired output port.
@@ -115,10 +407,68 @@ midiput(int n,Unchar* msg,int port,int chan)
 		 * don't put out anything.
 		 */
 		if ( port <= 0 || Midioutputs[port-1].opened == 0 ) {
-			return;
+			return 0;
 		}
 	}
+	return port;
+}
 
+/* Capture n bytes of MIDI output (see Bouncing) */
+static void
+bounceput(int n,Unchar *msg,int port)
+{
+	Noteptr nt;
+	long tm;
+	int i;
+
+	tm = *Now - Bouncenow;
+	if ( tm < 0 )
+		tm = 0;
+	nt = newnt();
+	timeof(nt) = tm;
+	flagsof(nt) = 0;
+	portof(nt) = port;
+#ifdef NTATTRIB
+	ntsetattrib(nt,Nullstr);
+#endif
+	if ( n <= 3 ) {
+		typeof(nt) = NT_LE3BYTES;
+		le3_nbytesof(nt) = n;
+		for ( i=0; i<n; i++ )
+			*ptrtobyte(nt,i) = msg[i];
+	}
+	else {
+		typeof(nt) = NT_BYTES;
+		messof(nt) = savemess(msg,n);
+	}
+	nextnote(nt) = NULL;
+	/* Time only goes forward, so this just goes on the end */
+	ntinsert(nt,Bouncephr);
+	if ( tm > Bouncephr->p_leng )
+		Bouncephr->p_leng = tm;
+}
+
+/*
+ * midiput
+ *
+ * Write n bytes of MIDI output.
+ * chan can be -1 if there is none.
+ */
+static void
+midiput(int n,Unchar* msg,int port,int chan)
+{
+	if ( Bouncephr != NULL ) {
+		bounceput(n,msg,port);
+		return;
+	}
+	if ( chan < 0 )
+		chan = 0;
+	port = outportof(port,chan);
+	if ( port <= 0 )
+		return;
+
+	if ( *Midicutoffcheck && n == 3 && (msg[0]&0xe0) == NOTEOFF )
+		countcutoffs(msg);
 
 	/* real MIDI output */
 	if ( *Debugmidi ) {
@@ -128,22 +478,26 @@ midiput(int n,Unchar* msg,int port,int chan)
 			tprint("%02x",msg[k]&0xff);
 		tprint(" , port=%d)\n",port);
 	}
+	else if ( Batching && *Midi_out_fnum < 0 ) {
+		batchmidi(n,(char*)msg,port);
+	}
 	else {
 		real_putnmidi(n,(char*)msg,port);
 	}
 }
 
-#define SETMILLI if ( ! *Sync ) {Midimilli=MILLICLOCK;}
+#define SETMILLI if ( ! *Sync ) {Midimilli=Grabmilli;}
 
 /* Macro here is an optimization (premature as always :-) to */
 /* avoid function calls for things called extremely often. */
 
 static int Ngrabbed = 0;
 static char *Grabbed = NULL;
+static long Grabmilli;	/* when the grabbed bytes arrived */
 
 #define GRABMIDI Grabcnt=0;while(1){\
 			if ( Ngrabbed <= 0 ) { \
-				Ngrabbed = real_getnmidi(Grabbuff,Grabbuffsize,&Currport); \
+				Ngrabbed = real_getnmidi(Grabbuff,Grabbuffsize,&Currport,&Grabmilli); \
 				if ( Ngrabbed <= 0 ) break; \
 				SETMILLI; \
 				Grabbed = Grabbuff; \
@@ -154,6 +508,140 @@ static char *Grabbed = NULL;
 			} \
 		}; grabout: Grabcnt=Grabcnt;
 
+/* If Midilookahead is > 0, scheduled events are handed to the mdep */
+/* layer up to that many milliseconds early, with the time at which */
+/* they should be sent, so that their timing doesn't depend on how */
+/* often we get to look at the schedule.  Tasks are never woken early. */
+static Symlongp Midilookahead;
+static long Passclock = 0;	/* MILLICLOCK at the start of this pass */
+static long Horizon = 0;	/* clicks up to which this pass handles things */
+static long Outtime = 0;	/* when midiput() output should be sent, */
+				/* or 0 for right away */
+static long Outlatest = 0;	/* latest time given to the mdep layer */
+
+/* Statistics about how late scheduled output is handed to the mdep */
+/* layer, compared to when it's scheduled.  See midi("timing"). */
+long Midioutcount = 0;
+long Midilatecount = 0;
+long Midilatetotal = 0;
+long Midilatemax = 0;
+long Midisends = 0;	/* number of calls to the mdep layer */
+long Midisendsaved = 0;	/* number of calls saved by batching */
+long Midilatehist[LATENCYBUCKETS];	/* how late each message was */
+long Midipasshist[LATENCYBUCKETS];	/* how long each pass took */
+long Midipasses = 0;		/* passes that handled the schedule */
+long Midithrottlehits = 0;	/* passes cut short by Midithrottle */
+long Miditoomany = 0;		/* times Maxatonce was exceeded */
+long Midicutoffs = 0;		/* note-offs that cut off a newer note */
+
+/* For counting Midicutoffs (only done when Midicutoffcheck is set, */
+/* for checklookahead() in benchrt.k): when the latest note-on of each channel and */
+/* pitch will be played, and how many of them are sounding.  A note-off */
+/* that will be played at the same time as a note-on sent before it, */
+/* while an older note of that pitch is still sounding, was meant for */
+/* the older note, but it ends the new one. */
+static long Lastontime[16][128];
+static int Nsounding[16][128];
+
+static void
+countcutoffs(Unchar *msg)
+{
+	int ch = msg[0] & 0xf, pitch = msg[1] & 0x7f;
+	long tm = Outtime>0 ? Outtime : MILLICLOCK;
+
+	if ( (msg[0]&0xf0) == NOTEON && msg[2] != 0 ) {
+		if ( Nsounding[ch][pitch] == 0 || tm > Lastontime[ch][pitch] )
+			Lastontime[ch][pitch] = tm;
+		Nsounding[ch][pitch]++;
+	}
+	else if ( Nsounding[ch][pitch] > 0 ) {
+		if ( Nsounding[ch][pitch] > 1 && tm == Lastontime[ch][pitch] )
+			Midicutoffs++;
+		Nsounding[ch][pitch]--;
+	}
+}
+
+/* Forget about the notes that countcutoffs() thinks are sounding */
+void
+clrcutoffs(void)
+{
+	int ch, pitch;
+
+	for ( ch=0; ch<16; ch++ ) {
+		for ( pitch=0; pitch<128; pitch++ ) {
+			Lastontime[ch][pitch] = 0;
+			Nsounding[ch][pitch] = 0;
+		}
+	}
+}
+
+/* If Midithru is non-zero (and Merge is on), the mdep layer echoes */
+/* channel messages from MIDI input as soon as they arrive, rather than */
+/* waiting for chkmidiinput() to get to them.  The routes are worked */
+/* out here, from the same variables that the echo in rc_on() etc. */
+/* uses, and notes also get Offsetpitch, as scheduled notes do. */
+static Symlongp Midithru;
+static int Thrutypes = 0;	/* bit (status>>4) is set for the types of */
+				/* channel message that the mdep layer echoes */
+static int Thrudirty = 1;	/* routes need to be worked out again */
+static Symlongp *Thruvars[] = {
+	&Midithru, &Merge, &Mergeport1, &Mergeport2, &Mergefilter,
+	&Filter, &Offsetpitch, &Offsetfilter, &Offsetportfilter,
+	&Forceinputport, &Echoport, &Debugmidi, &Midi_out_fnum,
+	NULL
+};
+static long Thruvals[sizeof(Thruvars)/sizeof(Thruvars[0])];
+
+/* Histograms of how long it took to echo MIDI input, in milliseconds. */
+/* Mergelatency is for when chkmidiinput() got to each message (i.e. */
+/* when Merge echoes it, without Midithru) and Thrulatency is for */
+/* messages echoed by the mdep layer.  See midi("thru"). */
+long Mergelatency[LATENCYBUCKETS];
+long Thrulatency[LATENCYBUCKETS];
+
+/* Convert a click to the time at which its output should be sent */
+/* (see Midilookahead), keeping track of how late we are.  Returns 0 */
+/* if it should be sent right away. */
+static long
+clicktime(long clicks)
+{
+	return Start + ((clicks-*Nowoffset)*Milltempo)/(*Clicks);
+}
+
+static long
+outtime(long clicks)
+{
+	long tm, late;
+
+	if ( *Sync )
+		return 0L;
+	tm = clicktime(clicks);
+	late = Passclock - tm;
+	Midioutcount++;
+	if ( late > 0 ) {
+		Midilatecount++;
+		Midilatetotal += late;
+		if ( late > Midilatemax )
+			Midilatemax = late;
+	}
+	latencyhist(Midilatehist,(late>0)?late:0L);
+	if ( tm <= Passclock )
+		return 0L;
+	if ( tm > Outlatest )
+		Outlatest = tm;
+	return tm;
+}
+
+static void
+real_outmidi(int n, char *buff, Midiport *p)
+{
+	Midisends++;
+	if ( Outtime > 0 )
+		mdep_putnmidiat(n,buff,p,Outtime);
+	else
+		mdep_putnmidi(n,buff,p);
+}
+
 static void
 real_putnmidi(int buffsize, char *buff,int port)
 {
@@ -175,18 +663,18 @@ real_putnmidi(int buffsize, char *buff,int port)
 	}
 	else {
 		if ( buffsize < MIDISENDLIMIT ) {
-			mdep_putnmidi(buffsize,buff, &Midioutputs[port-1] );
+			real_outmidi(buffsize,buff, &Midioutputs[port-1] );
 			if ( echoport > 0 )
-				mdep_putnmidi(buffsize,buff, &Midioutputs[echoport-1] );
+				real_outmidi(buffsize,buff, &Midioutputs[echoport-1] );
 		}
 		else {
 			while ( buffsize > 0 ) {
 				int cnt = buffsize;
 				if ( cnt > MIDISENDLIMIT )
 					cnt = MIDISENDLIMIT;
-				mdep_putnmidi(cnt,buff,&Midioutputs[port-1]);
+				real_outmidi(cnt,buff,&Midioutputs[port-1]);
 				if ( echoport > 0 )
-					mdep_putnmidi(cnt,buff,&Midioutputs[echoport-1]);
+					real_outmidi(cnt,buff,&Midioutputs[echoport-1]);
 				buff += cnt;
 				buffsize -= cnt;
 			}
@@ -194,13 +682,77 @@ real_putnmidi(int buffsize, char *buff,int port)
 	}
 }
 
+/* While chkmidioutput() is sending out the messages of a pass, they're */
+/* collected into one buffer per output port, so that each port gets */
+/* one call to the mdep layer (a crossing into JavaScript, in the wasm */
+/* build) rather than one per message.  Messages for a port are kept */
+/* in order, and a batch only holds messages with the same Outtime. */
+
+typedef struct Midibatch {
+	char *buff;
+	long size;	/* in bytes, as used by makeroom() */
+	int leng;	/* bytes in use */
+	int nmsgs;
+	long tm;	/* Outtime of everything in it */
+} Midibatch;
+
+static Midibatch Batch[MIDI_OUT_DEVICES];
+
+static void
+flushbatch(int port)
+{
+	Midibatch *b = &Batch[port-1];
+	long savetime = Outtime;
+
+	if ( b->nmsgs <= 0 )
+		return;
+	Outtime = b->tm;
+	real_putnmidi(b->leng,b->buff,port);
+	Outtime = savetime;
+	Midisendsaved += b->nmsgs - 1;
+	b->leng = 0;
+	b->nmsgs = 0;
+}
+
+static void
+flushbatches(void)
+{
+	int port;
+
+	for ( port=1; port<=MIDI_OUT_DEVICES; port++ )
+		flushbatch(port);
+}
+
+static void
+batchmidi(int n, char *msg, int port)
+{
+	Midibatch *b = &Batch[port-1];
+	char *p;
+
+	if ( b->nmsgs > 0 && (b->tm != Outtime || (b->leng+n) >= MIDISENDLIMIT) )
+		flushbatch(port);
+	if ( n >= MIDISENDLIMIT ) {
+		real_putnmidi(n,msg,port);
+		return;
+	}
+	makeroom((long)(b->leng+n),&(b->buff),&(b->size));
+	p = b->buff + b->leng;
+	b->leng += n;
+	while ( n-- > 0 )
+		*p++ = *msg++;
+	b->nmsgs++;
+	b->tm = Outtime;
+}
+
+/* Get bytes of MIDI input, all from the same port, and the time */
+/* (in MILLICLOCK terms) at which they arrived. */
 static int
-real_getnmidi(char *buff,int buffsize,int *port)
+real_getnmidi(char *buff,int buffsize,int *port,long *tm)
 {
 	int r;
 	int mdep_port;
 
-	r = mdep_getnmidi(buff,buffsize,&mdep_port);
+	r = mdep_getnmidiat(buff,buffsize,&mdep_port,tm);
 	// if ( r != 0 ) {
 	// 	keyerrfile("mdep_getnmidi r=%d\n",r);
 	// }
@@ -217,10 +769,109 @@ midiflush(void)
 {
 	char buff[64];
 	int dummy;
-	while ( real_getnmidi(buff,sizeof(buff),&dummy) > 0 )
+	long tm;
+	while ( real_getnmidi(buff,sizeof(buff),&dummy,&tm) > 0 )
 		;
 }
 
+/* Count a latency of ms milliseconds in one of the histograms */
+void
+latencyhist(long *hist,long ms)
+{
+	int i = 0;
+
+	while ( ms > 0 && i < LATENCYBUCKETS-1 ) {
+		ms >>= 1;
+		i++;
+	}
+	hist[i]++;
+}
+
+/* Called when something that the Midithru routes depend on (other */
+/* than the variables in Thruvars) has changed, e.g. the Portmap. */
+void
+thruchanged(void)
+{
+	Thrudirty = 1;
+}
+
+/* Work out the routes for the mdep layer's MIDI thru (see Midithru) */
+static void
+thruupdate(void)
+{
+	Midiport *outs[4];
+	int mergeports[2];
+	int i, n, ch, nouts, port, inport, offset, types;
+
+	Thrudirty = 0;
+	Thrutypes = 0;
+	mdep_midithru(0);
+	if ( *Midithru == 0 || *Merge == 0 || *Debugmidi || *Midi_out_fnum >= 0
+		|| Bouncing )
+		return;
+
+	mergeports[0] = (int)(*Mergeport1);
+	mergeports[1] = (int)(*Mergeport2);
+	for ( n=0; n<MIDI_IN_DEVICES; n++ ) {
+		if ( *Forceinputport >= 0 )
+			inport = (int)(*Forceinputport);
+		else
+			inport = n + MIDI_IN_PORT_OFFSET + 1;
+		for ( ch=0; ch<16; ch++ ) {
+			nouts = 0;
+			offset = 0;
+			if ( (*Mergefilter & (1<<ch)) == 0 ) {
+				for ( i=0; i<2; i++ ) {
+					if ( mergeports[i] < 0 )
+						continue;
+					port = outportof(mergeports[i],ch);
+					if ( port <= 0 )
+						continue;
+					outs[nouts++] = &Midioutputs[port-1];
+					if ( *Echoport > 0 && *Echoport < MIDI_IN_PORT_OFFSET )
+						outs[nouts++] = &Midioutputs[*Echoport-1];
+				}
+			}
+			if ( *Offsetpitch != 0 && *Offsetportfilter != inport
+				&& ((*Offsetfilter&(1<<ch))==0) )
+				offset = (int)(*Offsetpitch);
+			mdep_midithruroute(&Midiinputs[n],ch,nouts,outs,offset);
+		}
+	}
+
+	/* The same types of channel message that the rc_* functions echo */
+	types = (1<<(NOTEON>>4)) | (1<<(NOTEOFF>>4));
+	if ( (*Filter & M_PRESSURE) == 0 )
+		types |= (1<<(PRESSURE>>4));
+	if ( (*Filter & M_CONTROLLER) == 0 )
+		types |= (1<<(CONTROLLER>>4));
+	if ( (*Filter & M_PROGRAM) == 0 )
+		types |= (1<<(PROGRAM>>4));
+	if ( (*Filter & M_CHANPRESSURE) == 0 )
+		types |= (1<<(CHANPRESSURE>>4));
+	if ( (*Filter & M_PITCHBEND) == 0 )
+		types |= (1<<(PITCHBEND>>4));
+	Thrutypes = types;
+	mdep_midithru(types);
+}
+
+/* Work out the Midithru routes again if anything they depend on has */
+/* changed.  This is called often, so it needs to be quick. */
+static void
+chkthru(void)
+{
+	int i;
+
+	for ( i=0; Thruvars[i]!=NULL; i++ ) {
+		if ( Thruvals[i] != **Thruvars[i] ) {
+			Thruvals[i] = **Thruvars[i];
+			Thrudirty = 1;
+		}
+	}
+	if ( Thrudirty )
+		thruupdate();
+}
+
 static void
 put3midi(int c1,int c2,int c3,int port,int chan)
 {
@@ -242,8 +893,6 @@ put3midi(int c1,int c2,int c3,int port,int chan)
 
 extern struct midiaction Intmidi;	/* Defined below */
 
-Sched *Topsched = NULL;	/* Deferred events within realtime() */
-
 /* These hold noteons/off that are scheduled during a single click. */
 /* Use to guarantee noteoff's are before note-on's (within same click). */
 /* Offmsg2 holds note-offs that are scheduled by 0-duration notes, */
@@ -262,6 +911,9 @@ static int *Off2port;
 static Unchar *Onmonitor;
 static Unchar *Offmonitor;
 static Unchar *Off2monitor;
+static long *Onclicks;
+static long *Offclicks;
+static long *Off2clicks;
 
 Symlongp Maxatonce, Noteqsize;
 
@@ -274,8 +926,13 @@ static int Qbegin = 0;	/* index of head of circular queue */
 
 static Sched *Freesch = NULL;
 static Notedata Intnt;
-static Noteptr Earliestcurrent = NULL;
-static Noteptr Recmiddle = NULL;
+
+/* Notes that ntrecord() has been given, in the order they arrived, */
+/* that haven't been merged into the Recorded phrase yet.  They're */
+/* merged by recflush(), when something looks at Recorded. */
+static Noteptr Reclog = NULL;
+static Noteptr Reclogend = NULL;
+long Reclogged = 0;	/* number of notes in Reclog */
 
 #define NOACT ((actfunc)0)
 
@@ -323,6 +980,15 @@ startrealtime(void)
 	Offmonitor = (Unchar *) kmalloc(*Maxatonce,"startreal");
 	Off2monitor = (Unchar *) kmalloc(*Maxatonce,"startreal");
 
+	u = (unsigned)(*Maxatonce) * sizeof(long);
+	Onclicks = (long *) kmalloc(u,"startreal");
+	Offclicks = (long *) kmalloc(u,"startreal");
+	Off2clicks = (long *) kmalloc(u,"startreal");
+
+	installnum("Midilookahead",&Midilookahead,0L);
+	installnum("Midithru",&Midithru,0L);
+	installnum("Midicutoffcheck",&Midicutoffcheck,0L);
+
 	makeroom(256L,&Grabbuff,&Grabbuffsize);
 
 	for ( n=0; n<MIDI_IN_DEVICES; n++ ) {
@@ -335,17 +1001,18 @@ startrealtime(void)
 	if ( mdep_initmidi(Midiinputs,Midioutputs) == 0 ) {
 		Midiok = 1;
 		midiflush();
-		
+		thruchanged();
 	}
 
 	/* Free existing phrases in Current and (if recording) Record */
 	resetcurrphr();
 
 	if ( *Record ) {
+		freents(Reclog);
+		Reclog = Reclogend = NULL;
+		Reclogged = 0;
 		phdecruse(*Recphr);
 		*Recphr = newph(1);
-		Recmiddle = NULL;
-		Earliestcurrent = NULL;
 	}
 
 	Midi = Intmidi;		/* This is the structure that controls */
@@ -389,10 +1056,68 @@ newtempo(long t)
 	Start = t - ((*Now) * Milltempo)/(*Clicks);
 }
 
+/* Start running against a virtual clock, capturing MIDI output */
+void
+bouncestart(void)
+{
+	if ( Bouncing )
+		return;
+	Bounceclock = mdep_milliclock();
+	Bouncing = 1;
+	Bouncephr = newph(1);
+	Bouncenow = *Now < 0 ? 0 : *Now;
+	thruchanged();
+}
+
+/* Advance the virtual clock to the time of click clk, when there's */
+/* nothing else to do. */
+void
+bounceto(long clk)
+{
+	long tm;
+
+	/* Whatever's due at Now has been done, so at least go to the */
+	/* next click */
+	if ( clk <= *Now )
+		clk = *Now + 1;
+	/* Round up, so that Now gets to clk */
+	tm = Start + ((clk-*Nowoffset)*Milltempo+(*Clicks)-1)/(*Clicks);
+	if ( tm > Bounceclock )
+		Bounceclock = tm;
+}
+
+/* Go back to the real clock, carrying on from the virtual one. */
+/* Returns the captured output, whose use count the caller takes over. */
+Phrasep
+bouncestop(void)
+{
+	Phrasep p;
+	long delta;
+
+	if ( ! Bouncing )
+		return NULL;
+	delta = mdep_milliclock() - Bounceclock;
+	Bouncing = 0;
+	Start += delta;
+	if ( Nextclick >= 0 )
+		Nextclick += delta;
+	Passclock += delta;
+	if ( Outlatest > 0 )
+		Outlatest += delta;
+	p = Bouncephr;
+	Bouncephr = NULL;
+	thruchanged();
+	return p;
+}
+
 /* gets called in execerror(), in case of a signal interrupt */
 void
 resetreal(void)
 {
+	if ( Bouncing ) {
+		Phrasep p = bouncestop();
+		phdecruse(p);
+	}
 	*Now = -1;
 	*Nowoffset = 0;
 	Nextclick = -1;
@@ -400,18 +1125,18 @@ resetreal(void)
 	midiflush();
 	/* flushconsole(); */
 	finishoff();		/* Must be before clrsched.  */
-	clrsched(&Topsched);
+	clrsched();
 }
 
 /* Send note-offs for any unfinished notes in Currphr */
-/* and send any note-off's in Topsched.  Also make sure the Recphr is */
+/* and send any scheduled note-off's.  Also make sure the Recphr is */
 /* in canonical order. */
 
 void
 finishoff(void)
 {
-	register Sched *s;
-	int c, m;
+	Noteoff *no;
+	int c, m, k;
 	Noteptr n;
 
 	for ( n=firstnote(*Currphr); n!=NULL; n=nextnote(n) ) {
@@ -421,11 +1146,16 @@ finishoff(void)
 	}
 	resetcurrphr();
 
-	for ( s=Topsched; s!=NULL; s=s->next ) {
-		if ( s->type==SCH_NOTEOFF ) {	/* assume its a NOTEOFF */
-			n = s->note;
-			put3midi( (int)(NOTEOFF | chanof(n)), (int)pitchof(n), (int)volof(n), (int)portof(n), (int)chanof(n) );
-		}
+	/* Don't send these before anything that's been sent ahead of */
+	/* time (see Midilookahead) */
+	Outtime = Outlatest;
+
+	for ( k=0; k<Nnoteoff; k++ ) {
+		no = noteoffat(k);
+		if ( no->task == NULL )
+			continue;
+		c = no->chan & 0xf;
+		put3midi( (int)(NOTEOFF | c), (int)(no->pitch), (int)(no->vol), (int)(no->port), c );
 	}
 
 	for ( m=0; m<=MIDI_OUT_DEVICES; m++ ) {
@@ -440,9 +1170,11 @@ finishoff(void)
 			}
 		}
 	}
-	/* There's a bug, it seems, that gets stuff in this phreorder. */
-	/* The timeout is an attempt to try to isolate it. */
-	phreorder(*Recphr,MILLICLOCK+5000);
+	Outtime = 0;
+	clrcutoffs();
+
+	recflush();
+	phreorder(*Recphr);
 }
 
 /* Add a 3-byte message to the Recorded phrase and output it */
@@ -484,6 +1216,8 @@ chkrealoften(void)
 void
 chkmidiinput(void)
 {
+	chkthru();
+
 	/* Grab MIDI input (possibly echo it) */
 	/* and queue up the note on/off's to be */
 	/* processed. */
@@ -514,10 +1248,10 @@ chkmidiinput(void)
 void
 chkmidioutput(void)
 {
-	Sched *s, *pres, *nexts;
+	Sched *s, *held;
 	Ktaskp t;
-	int disable;
-	long throttle;
+	int disable, throttled = 0;
+	long throttle, passstart;
 
 	/* Don't bother looking at the schedule list until */
 	/* the time has advanced to the next click. */
@@ -540,7 +1274,9 @@ chkmidioutput(void)
 		 * using the Start time and the current value of the clock.
 		 */
 		nw = (*Clicks)*(clk-Start)/Milltempo;
-		Nextclick = Start + ((nw+1)*Milltempo)/(*Clicks);
+		/* Round up, otherwise clk can still be in click nw at */
+		/* Nextclick, and we'd keep making passes until it isn't. */
+		Nextclick = Start + ((nw+1)*Milltempo+(*Clicks)-1)/(*Clicks);
 		*Now = nw + *Nowoffset;
 		if ( Nextclick < lastnext ) {
 			tprint("Hey, Nextclick wrapped around!?  last=%ld next=%ld\n",lastnext,Nextclick);
@@ -548,9 +1284,15 @@ chkmidioutput(void)
 			Start = MILLICLOCK;
 			Nextclick = Start;
 		}
+		Passclock = clk;
 	}
+	passstart = MILLICLOCK;
+
+	/* Events up to the Horizon get handled in this pass */
+	Horizon = *Now;
+	if ( *Midilookahead > 0 && ! *Sync && ! Bouncing )
+		Horizon = (*Clicks)*(Passclock+*Midilookahead-Start)/Milltempo + *Nowoffset;
 
-	s = Topsched;
 	Numon = 0;
 	Numoff = 0;
 	Numoff2 = 0;
@@ -562,24 +1304,69 @@ chkmidioutput(void)
 	if ( throttle > *Maxatonce )
 		throttle = *Maxatonce-1;
 
-	dummyset(nexts);
-	for( pres=NULL; s != NULL; s=nexts){
+	/* Note-offs that complete NT_NOTEs go first, since we */
+	/* want to send them BEFORE anything else scheduled at */
+	/* the same time. */
+	while ( Nnoteoff > 0 ) {
+		Noteoff *no = noteoffat(0);
+		char *p;
 
-		/* Topsched list is sorted, so is safe to break early */
-		if ( s->clicks > *Now )
+		if ( no->clicks > Horizon )
 			break;
 
-		if ( --throttle <= 0 )
+		/* its task has been unscheduled, and it's already been sent */
+		if ( no->task == NULL ) {
+			noteoffpop();
+			continue;
+		}
+
+		if ( --throttle <= 0 ) {
+			throttled = 1;
 			break;
+		}
+
+		if ( Numoff >= *Maxatonce ) {
+			toomany("off");
+			Numoff = 0;
+		}
+		else {
+			Offport[Numoff] = no->port;
+			Offmonitor[Numoff] = ((no->chan & NOFF_MONITOR) != 0);
+			Offclicks[Numoff] = no->clicks;
+			p = &(Offmsg[3*Numoff++]);
+			*p++ = NOTEOFF | (no->chan & 0xf);
+			*p++ = no->pitch;
+			*p = no->vol;
+			Anynew = 1;
+		}
+		noteoffpop();
+	}
+
+	held = NULL;
+	while ( (s=firstsched()) != NULL ) {
+
+		/* The schedule is sorted, so it's safe to break early */
+		if ( s->clicks > Horizon )
+			break;
+
+		/* Don't wake tasks early, put them back after this pass */
+		if ( s->type == SCH_WAKE && s->clicks > *Now ) {
+			schedremove(s);
+			s->next = held;
+			held = s;
+			continue;
+		}
+
+		if ( --throttle <= 0 ) {
+			throttled = 1;
+			break;
+		}
 
 		disable = 1;
 		switch (s->type) {
 
-		case SCH_NOTEOFF:
-			disable = execnt(s,pres);
-			break;
 		case SCH_PHRASE:
-			disable = execnt(s,pres);
+			disable = execnt(s);
 			break;
 
 		case SCH_WAKE:
@@ -592,29 +1379,30 @@ chkmidioutput(void)
 
 		default:
 			eprint("(?=%d)",s->type);
-			disable = 0;
 			break;
 		}
-		nexts = s->next;	/* it's important that this be */
-					/* BELOW the execnt() call, */
-					/* because of repeat phrases */
-					/* that may be added. */
+		/* If it's not disabled, execnt() has already moved it */
+		/* to the time of its next note. */
 		if ( disable ) {
-			if ( pres == NULL )
-				Topsched = nexts;
-			else
-				pres->next = nexts;
+			schedremove(s);
 			freesch(s);
 		}
-		else
-			pres = s;
 	}
+	while ( held != NULL ) {
+		s = held;
+		held = s->next;
+		schedinsert(s);
+	}
+	if ( throttled )
+		Midithrottlehits++;
 	if ( Anynew ) {
 		int ismon = ISMONITORING;
+		Batching = 1;
 		/* We guarantee that note-off's preceed note-on's when they */
 		/* are scheduled at the same time.  This does NOT include */
 		/* note-off's that are newly scheduled (the Offmsg2 ones). */
 		while ( --Numoff >= 0 ) {
+			Outtime = outtime(Offclicks[Numoff]);
 			midiput( 3, (Unchar*)(&(Offmsg[3*Numoff])),Offport[Numoff],Offmsg[3*Numoff]&0xf);
 			if ( ismon && Offmonitor[Numoff] ) {
 				Unchar* cc = (Unchar*)(&(Offmsg[3*Numoff]));
@@ -623,6 +1411,7 @@ chkmidioutput(void)
 		}
 
 		while ( --Numon >= 0 ) {
+			Outtime = outtime(Onclicks[Numon]);
 			midiput( 3, (Unchar*)(&(Onmsg[3*Numon])),Onport[Numon],Onmsg[3*Numon]&0xf);
 			if ( ismon && Onmonitor[Numon] ) {
 				Unchar* cc = (Unchar*)(&(Onmsg[3*Numon]));
@@ -631,14 +1420,20 @@ chkmidioutput(void)
 		}
 
 		while ( --Numoff2 >= 0 ) {
+			Outtime = outtime(Off2clicks[Numoff2]);
 			midiput( 3, (Unchar*)(&(Offmsg2[3*Numoff2])),Off2port[Numoff2],Offmsg2[3*Numoff2]&0xf);
 			if ( ismon && Off2monitor[Numoff2] ) {
 				Unchar* cc = (Unchar*)(&(Offmsg2[3*Numoff2]));
 				put3onmonitorfifo(*cc,*(cc+1),*(cc+2));
 			}
 		}
+		Outtime = 0;
+		flushbatches();
+		Batching = 0;
 
 	}
+	Midipasses++;
+	latencyhist(Midipasshist,MILLICLOCK-passstart);
 	return;
 }
 
@@ -671,7 +1466,7 @@ chanofbyte(int b)
  */
 
 int
-execnt(register Sched *s, Sched *pres)
+execnt(register Sched *s)
 {
 	register Noteptr n;
 	int nttype, bytetype;
@@ -685,9 +1480,7 @@ sametime:
 	nttype = typeof(n);
 	realpitch = pitchof(n);
 
-	if ( nttype==NT_ON
-		|| nttype==NT_NOTE 
-		|| ( nttype == NT_OFF && s->offtype != OFF_INTERNAL ) ) {
+	if ( nttype==NT_ON || nttype==NT_NOTE || nttype == NT_OFF ) {
 		/* Apply Offsetpitch */
 		if ( *Offsetpitch != 0 && *Offsetportfilter != portof(n) && ((*Offsetfilter&(1<<chanof(n)))==0) ) {
 			int tmp = realpitch + (int)*Offsetpitch;
@@ -699,7 +1492,7 @@ sametime:
 		}
 	}
 		
-	if ( *Recsched && *Record && (s->offtype == OFF_USER) ) {
+	if ( *Recsched && *Record ) {
 		int recordit = 0;
 		/* Figure out whether we need to record it. */
 		switch(nttype){
@@ -739,7 +1532,9 @@ sametime:
 			/* but other types of text notes are ignored (so far) */
 		}
 		else {
+			Outtime = outtime(s->clicks);
 			midiput(ntbytesleng(n),b,portof(n),chanofbyte(b[0]));
+			Outtime = 0;
 		}
 		if ( s->monitor )
 			putonmonitorfifo(n);
@@ -755,30 +1550,23 @@ sametime:
 			/* want to send right away */
 			Onport[Numon] = portof(n);
 			Onmonitor[Numon] = s->monitor;
+			Onclicks[Numon] = s->clicks;
 			p = &(Onmsg[3*Numon++]);
 			bytetype = NOTEON;
 		}
 		else {
-			if ( Numoff >= *Maxatonce ) {
+			if ( Numoff2 >= *Maxatonce ) {
 				toomany("off");
-				Numoff = 0;
+				Numoff2 = 0;
 				goto toomuch;
 			}
-			if ( s->offtype == OFF_INTERNAL ) {
-				/* it's a note-off to complete a NT_NOTE, */
-				/* and we want to send these BEFORE anything */
-				/* else scheduled at the same time. */
-				Offport[Numoff] = portof(n);
-				Offmonitor[Numoff] = s->monitor;
-				p = &(Offmsg[3*Numoff++]);
-			}
-			else {
-				/* User-scheduled note-off's we */
-				/* send AFTER */
-				Off2port[Numoff2] = portof(n);
-				Off2monitor[Numoff2] = s->monitor;
-				p = &(Offmsg2[3*Numoff2++]);
-			}
+			/* User-scheduled note-off's we send AFTER */
+			/* the note-on's (note-offs that complete */
+			/* NT_NOTEs are handled in chkmidioutput) */
+			Off2port[Numoff2] = portof(n);
+			Off2monitor[Numoff2] = s->monitor;
+			Off2clicks[Numoff2] = s->clicks;
+			p = &(Offmsg2[3*Numoff2++]);
 			bytetype = NOTEOFF;
 		}
 		*p++ = bytetype | chanof(n);
@@ -798,26 +1586,39 @@ sametime:
 			if ( dur == 0 || (s->clicks+dur) <= *Now ) {
 				Off2port[Numoff2] = portof(n);
 				Off2monitor[Numoff2] = s->monitor;
+				Off2clicks[Numoff2] = s->clicks;
 				p = &(Offmsg2[3*Numoff2++]);
 				*p++ = NOTEOFF | chanof(n);
 				*p++ = realpitch;
 				*p++ = volof(n);
 			}
+			/* If it's within this pass's look-ahead, it goes */
+			/* with the note-offs we send before the note-ons, */
+			/* since the ones from the noteoff heap have already */
+			/* been taken.  Otherwise a note struck again at */
+			/* the same time would get this note-off's timestamp */
+			/* in a later pass, and be cut off.  It has to be */
+			/* sent later than its own note-on, though. */
+			else if ( (s->clicks+dur) <= Horizon
+				&& clicktime(s->clicks+dur) > Passclock
+				&& clicktime(s->clicks+dur) > clicktime(s->clicks) ) {
+				if ( Numoff >= *Maxatonce ) {
+					toomany("off");
+					Numoff = 0;
+					goto toomuch;
+				}
+				Offport[Numoff] = portof(n);
+				Offmonitor[Numoff] = s->monitor;
+				Offclicks[Numoff] = s->clicks+dur;
+				p = &(Offmsg[3*Numoff++]);
+				*p++ = NOTEOFF | chanof(n);
+				*p++ = realpitch;
+				*p++ = volof(n);
+			}
 			else {
-				/* schedule a copy of the note-on note */
-				/* as the note-off */
-				Noteptr nn = ntcopy(n);
-				Sched *ns;
-				long offtime = s->clicks + dur;
-
-				pitchof(nn) = realpitch;
-				nextnote(nn) = NULL;
-				typeof(nn) = NT_OFF;
-				ns = immsched ( SCH_NOTEOFF, offtime, s->task, s->monitor );
-				s->task->schedcnt++;
-				ns->note = nn;
-				ns->offtype = OFF_INTERNAL;
-				ns->repeat = 0L;
+				noteoffsched(s->clicks+dur, s->task,
+					portof(n), chanof(n), realpitch,
+					volof(n), s->monitor);
 			}
 		}
 	}
@@ -853,17 +1654,8 @@ sametime:
 		/* current clicks value includes the start time of the */
 		/* phrase AND the time of the note) */
 		s->clicks = s->clicks - timeof(n) + timeof(nxt);
-		/* move Sched node, to maintain sorting of list */
-		while ( s->next != NULL && s->clicks >= s->next->clicks ) {
-			Sched *ns = s->next;
-			if ( pres == NULL )
-				Topsched = ns;
-			else
-				pres->next = ns;
-			s->next = ns->next;
-			ns->next = s;
-			pres = ns;
-		}
+		/* move Sched node, to maintain sorting of the schedule */
+		schedmove(s);
 	}
 	else {
 		/* when we've played (or more accurately, started) the last */
@@ -882,6 +1674,7 @@ toomany(char *onoff)
 	long tm = MILLICLOCK;
 	long dt = tm - lasttime;
 
+	Miditoomany++;
 	if ( dt < 0 )
 		dt = -dt;
 	/* Warn no more often than every couple seconds */
@@ -899,20 +1692,30 @@ toomany(char *onoff)
 /* things into the Noteq array, which is then later processed more */
 /* completely. */
 
+/* Echo MIDI input to the Merge ports, unless the mdep layer has */
+/* already done it (see Midithru). */
+static void
+mergeecho(Unchar *mess,int indx,int chan)
+{
+	latencyhist(Mergelatency,MILLICLOCK-Grabmilli);
+	if ( chan >= 0 && (Thrutypes & (1<<((mess[0]>>4)&0xf))) != 0 )
+		return;
+	if ( *Mergeport1 >= 0 ) {
+		midiput(indx,mess,*Mergeport1,chan);
+	}
+	if ( *Mergeport2 >= 0 ) {
+		midiput(indx,mess,*Mergeport2,chan);
+	}
+}
+
 void
 rc_on(Unchar *mess,int indx)
 {
 	register Noteptr q;
 
 	if ( *Merge != 0 ) {
-		if ( *Mergefilter == 0 || ( (1<<Currchan) & *Mergefilter)==0 ) {
-			if ( *Mergeport1 >= 0 ) {
-				midiput(indx,mess,*Mergeport1,Currchan);
-			}
-			if ( *Mergeport2 >= 0 ) {
-				midiput(indx,mess,*Mergeport2,Currchan);
-			}
-		}
+		if ( *Mergefilter == 0 || ( (1<<Currchan) & *Mergefilter)==0 )
+			mergeecho(mess,indx,Currchan);
 	}
 	if ( (q=qnote(Currchan)) == NULL )
 		return;
@@ -929,14 +1732,8 @@ rc_off(Unchar *mess,int indx)
 	register Noteptr q;
 
 	if ( *Merge != 0 ) {
-		if ( *Mergefilter == 0 || ( (1<<Currchan) & *Mergefilter)==0 ) {
-			if ( *Mergeport1 >= 0 ) {
-				midiput(indx,mess,*Mergeport1,Currchan);
-			}
-			if ( *Mergeport2 >= 0 ) {
-				midiput(indx,mess,*Mergeport2,Currchan);
-			}
-		}
+		if ( *Mergefilter == 0 || ( (1<<Currchan) & *Mergefilter)==0 )
+			mergeecho(mess,indx,Currchan);
 	}
 	if ( (q=qnote(Currchan)) == NULL )
 		return;
@@ -958,14 +1755,8 @@ rc_messhandle(Unchar *mess,int indx, int chan)
 	register Noteptr q;
 
 	if ( *Merge != 0 ) {
-		if ( chan<0 || *Mergefilter == 0 || ( (1<<chan) & *Mergefilter)==0 ) {
-			if ( *Mergeport1 >= 0 ) {
-				midiput(indx,mess,*Mergeport1,chan);
-			}
-			if ( *Mergeport2 >= 0 ) {
-				midiput(indx,mess,*Mergeport2,chan);
-			}
-		}
+		if ( chan<0 || *Mergefilter == 0 || ( (1<<chan) & *Mergefilter)==0 )
+			mergeecho(mess,indx,chan);
 	}
 	if ( (q=qnote(-1)) == NULL )
 		return;
@@ -1159,7 +1950,7 @@ qnote(int chan)
 		chan = 0;	/* default is channel 1 */
 	portof(q) = Currport;
 #ifdef NTATTRIB
-	attribof(q) = Nullstr;
+	ntsetattrib(q,Nullstr);
 #endif
 	return q;
 }
@@ -1178,7 +1969,7 @@ noteon(register Noteptr q)
 	flagsof(&Intnt) = 0;
 	portof(&Intnt) = portof(q);
 #ifdef NTATTRIB
-	attribof(&Intnt) = attribof(q);
+	ntsetattrib(&Intnt,attribof(q));
 #endif
 	nextnote(&Intnt) = NULL;
 
@@ -1186,6 +1977,7 @@ noteon(register Noteptr q)
 
 	/* Always add the new notes to the start of the Current phrase, */
 	/* so that Current[0] is always the most recent note. */
+	phchanged(*Currphr);
 	nextnote(n) = firstnote(*Currphr);
 	setfirstnote(*Currphr) = n;
 
@@ -1210,21 +2002,8 @@ noteoff(Noteptr q)
 	if ( n == NULL )
 		return;	/* couldn't find note-on to match the note-off */
 
-	/* we want to note the fact if this is the earliest (ie. last) */
-	/* note in the Currphr, so we can adjust Recmiddle. */
-
-#ifdef OLDSTUFF
-	if ( *Record && *Recinput && (*Recfilter & (1<<chanof(n))) == 0 )
-#endif
-
-	if ( nextnote(n) == NULL ) {
-		Earliestcurrent = n;
-	}
-	else {
-		Earliestcurrent = NULL;
-	}
-		
 	/* Remove the note from the Current phrase. */
+	phchanged(*Currphr);
 	if ( n == firstnote(*Currphr))
 		setfirstnote(*Currphr) = nextnote(n);
 	else
@@ -1248,7 +2027,7 @@ noteoff(Noteptr q)
 	flagsof(&Intnt) = flagsof(n);
 	portof(&Intnt) = portof(n);
 #ifdef NTATTRIB
-	attribof(&Intnt) = attribof(n);
+	ntsetattrib(&Intnt,attribof(n));
 #endif
 
 	putonmidiinfifo(&Intnt);
@@ -1267,7 +2046,7 @@ notemess(Noteptr q)
 	flagsof(&Intnt) = flagsof(q);
 	portof(&Intnt) = portof(q);
 #ifdef NTATTRIB
-	attribof(&Intnt) = attribof(q);
+	ntsetattrib(&Intnt,attribof(q));
 #endif
 	nextnote(&Intnt) = NULL;
 
@@ -1334,79 +2113,83 @@ put3onmonitorfifo(int c1, int c2, int c3)
 }
 
 /* ntrecord(n) - Add a note to the Recorded phrase. */
+/* It's only added to the log of recorded notes here, which keeps the */
+/* cost of recording a note the same however long the take gets. */
 void
 ntrecord(Noteptr n)
 {
-	Noteptr pren, sn, tn;
-
 	if ( *Record == 0 || (*Recfilter & (1<<chanof(n))) != 0 )
 		return;
 
-	if ( phreallyused(*Recphr) > 1 ) {
-		Phrasep p;
+	/* NO need to make a ntcopy() of n, we own this one. */
+
+	nextnote(n) = NULL;
+	if ( Reclogend == NULL )
+		Reclog = n;
+	else
+		nextnote(Reclogend) = n;
+	Reclogend = n;
+	Reclogged++;
+}
 
+/* recflush() - Merge the log of recorded notes into the Recorded */
+/* phrase.  This is called (see chkrecorded()) whenever the Recorded */
+/* variable is looked at. */
+void
+recflush(void)
+{
+	Phrasep ph;
+	Noteptr n, last, tail;
+	long leng;
+
+	if ( Reclog == NULL )
+		return;
+
+	/* Notes are logged when they end, so they aren't quite in order */
+	n = ntsortlist(Reclog);
+	Reclog = Reclogend = NULL;
+	Reclogged = 0;
+
+	ph = phcow(*Recphr,1,1);
+	if ( ph != *Recphr ) {
 		phdecruse(*Recphr);
-		p = newph(1);
-		phcopy(p,*Recphr);
-		*Recphr = p;
-		Recmiddle = NULL;
-		Earliestcurrent = NULL;
+		*Recphr = ph;
 	}
+	ph = *Recphr;
+	phchanged(ph);
 
-	/* NO need to make a ntcopy() of n, we own this one. */
-
-	/* Recmiddle is a pointer to the note in Recphr whose time is */
-	/* guaranteed to be before any of the notes in Currphr.  We use */
-	/* this as the starting point for the insertion search. */
-	pren = Recmiddle;	/* possibly NULL, if Recphr is empty */
-	if ( pren == NULL )
-		sn = Recmiddle = firstnote(*Recphr);
-	else
-		sn = nextnote(pren);
-	while ( sn!=NULL ) {
-		if ( ntcmporder(sn,n) > 0 )
+	leng = ph->p_leng;
+	for ( tail=n; ; tail=nextnote(tail) ) {
+		if ( endof(tail) > leng )
+			leng = endof(tail);
+		if ( nextnote(tail) == NULL )
 			break;
-		pren = sn;
-		sn = nextnote(sn);
 	}
-	nextnote(n) = sn;
-	if ( sn == NULL )
-		lastnote(*Recphr) = n;
+	ph->p_leng = leng;
 
-	if ( pren == NULL )
-		setfirstnote(*Recphr) = n;
-	else
-		nextnote(pren) = n;
+	/* p_end can be NULL when it's not known */
+	last = lastnote(ph);
+	if ( last == NULL && firstnote(ph) != NULL ) {
+		for ( last=firstnote(ph); nextnote(last)!=NULL; last=nextnote(last) )
+			;
+	}
 
-	if ( Earliestcurrent ) {
-		if ( n == Earliestcurrent ) {
-			Recmiddle = n;
-			Earliestcurrent = NULL;
-		}
-		else {
-			/* no longer unexpected, if Recinput is 0 */
-#ifdef OLDSTUFF
-eprint("I don't expect this to happen (Earliestcurrent) n.time=%ld earliest=%ld\n",timeof(n),timeof(Earliestcurrent));
-#endif
-		}
+	if ( last == NULL ) {
+		setfirstnote(ph) = n;
+		lastnote(ph) = tail;
 	}
-	else {
-		Noteptr ntn;
-
-		ntn = NULL;
-		for ( tn=Recmiddle; tn!=NULL; tn=ntn ) {
-			ntn = nextnote(tn);
-			if ( ntn == NULL )
-				break;
-			if ( Topsched!=NULL && timeof(ntn) >= Topsched->clicks )
-				break;
-		}
-		if ( tn )
-			Recmiddle = tn;
+	else if ( ntcmporder(last,n) <= 0 ) {
+		/* The usual case, all the new notes go on the end */
+		nextnote(last) = n;
+		lastnote(ph) = tail;
 	}
-
-	if ( endof(n) > (*Recphr)->p_leng ) {
-		(*Recphr)->p_leng = endof(n);
+	else {
+		/* Some notes (e.g. long ones, which are logged when they */
+		/* end) belong earlier, so it has to be merged. */
+		setfirstnote(ph) = ntmergelist(firstnote(ph),n);
+		if ( ntcmporder(last,tail) > 0 )
+			tail = last;
+		lastnote(ph) = tail;
 	}
 }
 
@@ -1431,18 +2214,14 @@ struct midiaction Intmidi = {
 	rc_mess		/* reset */
 };
 
-/* clear a schedule list */
+/* clear the schedule */
 void
-clrsched(Sched **as)
+clrsched(void)
 {
-	register Sched *s, *nxt;
-
-	dummyset(nxt);
-	for ( s=(*as); s!=NULL; s=nxt ) {
-		nxt = s->next;
-		freesch(s);
-	}
-	*as = NULL;
+	while ( Nsched > 0 )
+		freesch(Schedheap[--Nsched]);
+	while ( Nnoteoff > 0 )
+		noteofffree(Noteoffheap[--Nnoteoff]);
 }
 
 Sched *
@@ -1471,43 +2250,41 @@ newsch(void)
 void
 unsched(Task *t)
 {
-	register Sched *s, *pres;
+	register Sched *s;
+	Noteoff *no;
+	int slot, c;
 
-	for ( pres=NULL,s=Topsched; s!=NULL; ) {
+	/* The task keeps lists of its own events, so this doesn't */
+	/* have to look through the whole schedule. */
 
-		if ( s->task == t ) {
-			register Sched *nexts = s->next;
-			if ( s->type == SCH_NOTEOFF ) {
-				Noteptr n = s->note;
-				put3midi( (int)(NOTEOFF | chanof(n)), (int)pitchof(n), (int)volof(n), (int)portof(n), (int)chanof(n) );
-			}
-			/* remove it from schedule list and free it */
-			if ( pres == NULL )
-				Topsched = nexts;
-			else
-				pres->next = nexts;
-			freesch(s);
-			s = nexts;
-		}
-		else {
-			pres = s;
-			s = s->next;
-		}
+	/* Send the task's pending note-offs right away (but not before */
+	/* anything that's been sent ahead of time, see Midilookahead) */
+	Outtime = Outlatest;
+	while ( (slot=t->noteoffs) >= 0 ) {
+		no = &Noteoffpool[slot];
+		c = no->chan & 0xf;
+		put3midi( (int)(NOTEOFF | c), (int)(no->pitch), (int)(no->vol), (int)(no->port), c );
+		noteoffdetach(slot);
+	}
+	Outtime = 0;
+
+	while ( (s=t->schedlist) != NULL ) {
+		schedremove(s);
+		freesch(s);	/* this takes it off t->schedlist */
 	}
 }
 
 void
 freesch(register Sched *s)
 {
+	if ( s->tprev != NULL )
+		s->tprev->tnext = s->tnext;
+	else
+		s->task->schedlist = s->tnext;
+	if ( s->tnext != NULL )
+		s->tnext->tprev = s->tprev;
+
 	switch ( s->type ) {
-	case SCH_NOTEOFF:
-	 	/* If it's a single note, we can free it with no delay */
-		ntfree(s->note);
-		if ( --(s->task->schedcnt) <= 0 ) {
-			wakewaiters(s->task);
-			deletetask(s->task);
-		}
-		break;
 	case SCH_PHRASE:
 		phdecruse(s->phr);
 		if ( --(s->task->schedcnt) <= 0 ) {
@@ -1528,33 +2305,25 @@ immsched(int type,long clicks,Ktaskp tp,int monitor)
 {
 	Sched *s;
 
-	/* add a new one to the end of the list. */
 	s = newsch();
 	s->type = type;
 	s->clicks = clicks;
 	s->note = NULL;
 	s->phr = NULL;
-	s->offtype = OFF_USER;
 	s->task = tp;
 	s->repeat = 0L;
 	s->monitor = monitor;
+	s->next = NULL;
 
-	/* insert into list, sorted by clicks */
-	if ( Topsched == NULL || clicks < Topsched->clicks ) {
-		s->next = Topsched;
-		Topsched = s;
-	}
-	else {
-		register Sched *prev = Topsched;
-		register Sched *t = prev->next;
-		/* find place in list */
-		for ( ; t!=NULL; prev=t,t=t->next ) {
-			if ( clicks < t->clicks )
-				break;
-		}
-		s->next = t;
-		prev->next = s;
-	}
+	/* add it to the task's list */
+	s->tprev = NULL;
+	s->tnext = tp->schedlist;
+	if ( tp->schedlist != NULL )
+		tp->schedlist->tprev = s;
+	tp->schedlist = s;
+
+	/* insert into the schedule, sorted by clicks */
+	schedinsert(s);
 	return(s);
 }
 
@@ -24,7 +24,8 @@ Symlongp Drawcount, Mousedisable, Forceinputport, Showsync, Echoport;
 Symlongp Inputistty, Debugoff, Fakewrap, Mfsysextype;
 Symlongp Tempotrack, Onoffmerge, Defrelease, Grablimit, Mfformat, Defoutport;
 Symlongp Filter, Record, Recsched, Throttle, Recfilter, Recinput, Recsysex;
-Symlongp Lowcorelim, Arraysort, Midithrottle, Defpriority;
+Symlongp Lowcorelim, Arraysort, Midithrottle, Defpriority, Phindexmin;
+Symlongp Reclaimslice, Strsweep;
 Symlongp Taskaddr, Debuginst, Usewindfifos, Prepoll, Printsplit;
 Symlongp Novalval, Eofval, Intrval, Debugkill, Debugkill1, Linetrace;
 Symlongp Abortonint, Abortonerr, Redrawignoretime, Resizeignoretime;
@@ -99,6 +100,7 @@ newsy(void)
 
     getout:
 	s->stype = UNDEF;
+	s->sd = Noval;		/* strsweep() looks at it */
 	s->stackpos = 0;	/* i.e. it's global */
 	s->flags = 0;
 	s->onchange = NULL;
@@ -285,6 +287,10 @@ clearsym(register Symbolp s)
 #endif
 			dp->u.codep = NULL;
 			break;
+		case D_STR:
+			/* a string being built by "var += str" */
+			strdropd(*dp);
+			break;
 		default:
 			break;
 		}
@@ -453,7 +459,9 @@ datumstr(Datum d)
 		p = "";
 		break;
 	}
-	p = uniqstr(p);
+	/* Anything that keeps it somewhere other than a Datum has */
+	/* to uniqstr() it again. */
+	p = uniqstrtmp(p);
 	return p;
 }
 
@@ -780,6 +788,9 @@ static struct binum {
 	{ "Isofuncwarn", 1L, &Isofuncwarn },
 	{ "Inputistty", 0L, &Inputistty },
 	{ "Arraysort", 0, &Arraysort },
+	{ "Phindexmin", 32, &Phindexmin },	/* see phindex() */
+	{ "Reclaimslice", 1000, &Reclaimslice },	/* see reclaim() */
+	{ "Strsweep", 10000, &Strsweep },	/* see strsweep() */
 	{ "Taskaddr", 0, &Taskaddr },
 	{ "Tempotrack", 0, &Tempotrack },
 	{ "Onoffmerge", 1, &Onoffmerge },
@@ -1345,19 +1356,44 @@ chkfreeht() {
 }
 #endif
 
+Hnode Htdeleted;	/* see HT_DELETED */
+
+static Htslot *
+newslots(int size)
+{
+	register Htslot *sl, *slots;
+
+	slots = (Htslot *) kmalloc( size * sizeof(Htslot), "newslots" );
+	/* initialize entire table to empty slots */
+	sl = slots + size;
+	while ( sl-- != slots )
+		sl->node = NULL;
+	return(slots);
+}
+
+/* The keys of ht are changing, so its sorted list of them is no good */
+static void
+htunsort(Htablep ht)
+{
+	if ( ht->h_sorted != NULL ) {
+		kfree(ht->h_sorted);
+		ht->h_sorted = NULL;
+	}
+}
+
 /* To avoid freeing and re-allocating the large chunks of memory */
 /* used for the hash tables, we keep them around and reuse them. */
 
 Htablep
 newht(int size)
 {
-	register Hnodepp h, pp;
 	register Htablep ht;
 
 /* eprint("(newht(%d ",size); */
-	/* See if there's a saved table we can use */
+	/* See if there's a saved table we can use.  One whose slots */
+	/* were thrown away by freeht() can be given new ones. */
 	for ( ht=Freeht; ht!=NULL; ht=ht->h_next ) {
-		if ( ht->size == size )
+		if ( ht->size == size || ht->slots == NULL )
 			break;
 	}
 	if ( ht != NULL ) {
@@ -1379,16 +1415,24 @@ newht(int size)
 	}
 	else {
 		ht = (Htablep) kmalloc( sizeof(Htable), "newht" );
-		h = (Hnodepp) kmalloc( size * sizeof(Hnodep), "newht" );
+		ht->slots = NULL;
+		ht->dense = NULL;
+		ht->densesize = 0;
+		ht->h_sorted = NULL;
+	}
+	if ( ht->slots == NULL ) {
 		ht->size = size;
-		ht->nodetable = h;
-		/* initialize entire table to NULLS */
-		pp = h + size;
-		while ( pp-- != h )
-			*pp =  NULL;
+		ht->slots = newslots(size);
 	}
 
 	ht->count = 0;
+	ht->nused = 0;
+	ht->ndeleted = 0;
+	ht->oldslots = NULL;
+	ht->oldsize = 0;
+	ht->oldpos = 0;
+	ht->h_visiting = 0;
+	ht->ndense = 0;
 	ht->h_used = 0;
 	ht->h_tobe = 0;
 	ht->h_next = NULL;
@@ -1405,27 +1449,93 @@ newht(int size)
 void
 clearht(Htablep ht)
 {
-	register Hnodep hn, nexthn;
-	register Hnodepp pp;
-	register int n = ht->size;
-	
-	pp = ht->nodetable;
+	register Htslot *sl, *end;
+	register int i;
+
 	/* as we're freeing the Hnodes pointed to by this hash table, */
-	/* we zero out the table, in preparation for its reuse. */
-#ifdef lint
-	nexthn = 0;
-#endif
-	if ( ht->count != 0 ) {
-		while ( --n >= 0 ) {
-			for ( hn=(*pp); hn != NULL; hn=nexthn ) {
-				nexthn = hn->next;
-/* if(*Debug>0)eprint("freehn being called from clearht\n"); */
-				freehn(hn);
-			}
-			*pp++ = NULL;
+	/* we empty out the table, in preparation for its reuse. */
+	htunsort(ht);
+	for ( i=0; i<ht->ndense; i++ )
+		freehn(ht->dense[i]);
+	ht->ndense = 0;
+	if ( ht->nused != 0 || ht->ndeleted != 0 ) {
+		end = ht->slots + ht->size;
+		for ( sl=ht->slots; sl!=end; sl++ ) {
+			if ( sl->node != NULL && sl->node != HT_DELETED )
+				freehn(sl->node);
+			sl->node = NULL;
 		}
 	}
+	if ( ht->oldslots != NULL ) {
+		end = ht->oldslots + ht->oldsize;
+		for ( sl=ht->oldslots+ht->oldpos; sl<end; sl++ ) {
+			if ( sl->node != NULL && sl->node != HT_DELETED )
+				freehn(sl->node);
+		}
+		kfree(ht->oldslots);
+		ht->oldslots = NULL;
+	}
+	ht->oldsize = 0;
+	ht->oldpos = 0;
 	ht->count = 0;
+	ht->nused = 0;
+	ht->ndeleted = 0;
+}
+
+/*
+ * Free up to budget elements of ht (or all of them, if budget <= 0),
+ * for emptying a table a bit at a time.  *pos is the next slot to look
+ * at, and starts at 0.  The table is empty when *pos has reached
+ * ht->size and ht->oldslots is NULL.  Returns the number freed.
+ */
+long
+clearhtsome(Htablep ht,long budget,int *pos)
+{
+	register Htslot *sl;
+	long nfreed = 0;
+
+	htunsort(ht);
+	/* the dense elements go first, from the end */
+	while ( ht->ndense > 0 ) {
+		if ( budget > 0 && nfreed >= budget )
+			return nfreed;
+		freehn(ht->dense[--ht->ndense]);
+		ht->count--;
+		nfreed++;
+	}
+	while ( *pos < ht->size ) {
+		sl = &ht->slots[*pos];
+		if ( sl->node != NULL && sl->node != HT_DELETED ) {
+			if ( budget > 0 && nfreed >= budget )
+				return nfreed;
+			freehn(sl->node);
+			sl->node = HT_DELETED;
+			ht->nused--;
+			ht->ndeleted++;
+			ht->count--;
+			nfreed++;
+		}
+		(*pos)++;
+	}
+	while ( ht->oldslots != NULL ) {
+		if ( ht->oldpos >= ht->oldsize ) {
+			kfree(ht->oldslots);
+			ht->oldslots = NULL;
+			ht->oldsize = 0;
+			ht->oldpos = 0;
+			break;
+		}
+		sl = &ht->oldslots[ht->oldpos];
+		if ( sl->node != NULL && sl->node != HT_DELETED ) {
+			if ( budget > 0 && nfreed >= budget )
+				return nfreed;
+			freehn(sl->node);
+			ht->count--;
+			nfreed++;
+		}
+		ht->oldpos++;
+	}
+	return nfreed;
 }
 
 void
@@ -1456,6 +1566,28 @@ freeht(Htablep ht)
 			abort();
 		}
 	}
+	/* If it's in the Topht list, remove it (strsweep() goes */
+	/* through that list, so it has to be right). */
+	if ( ht->h_state == 0 ) {
+		if ( ht->h_next )
+			ht->h_next->h_prev = ht->h_prev;
+		if ( ht == Topht )
+			Topht = ht->h_next;
+		else if ( ht->h_prev )
+			ht->h_prev->h_next = ht->h_next;
+	}
+	/* Don't keep the slots of tables that have grown big */
+	if ( ht->size > HTKEEPSIZE ) {
+		kfree(ht->slots);
+		ht->slots = NULL;
+		ht->size = 0;
+	}
+	if ( ht->densesize > HTKEEPSIZE*(long)sizeof(Hnodep) ) {
+		kfree(ht->dense);
+		ht->dense = NULL;
+		ht->densesize = 0;
+		ht->h_sorted = NULL;
+	}
 	/* Add to Freeht list */
 	if ( Freeht )
 		Freeht->h_prev = ht;
@@ -1482,80 +1614,473 @@ htlists(void)
 	eprint("\n");
 }
 
-Htablep Stringtable = NULL;
+/*
+ * uniqstr() interns strings, so that equal strings are the same
+ * pointer.  Each one is allocated along with its hash value and its
+ * link in the Strtable chain, and Strtable (whose size is a power of 2)
+ * doubles whenever there are more strings than chains.
+ *
+ * Strings made by uniqstrtmp() - the results of adding strings,
+ * sprintf(), and lines read from fifos - are reclaimed by strsweep()
+ * once nothing refers to them.  Any string that uniqstr() is called
+ * with is kept for good, so C code that holds on to a string (like
+ * a symbol name, a menu item or a lock name) gets it from uniqstr().
+ */
+typedef struct Strnode {
+	struct Strnode *next;
+	unsigned int hash;
+	char tmp;	/* from uniqstrtmp(), and not (yet) from uniqstr() */
+	char mark;	/* referred to, see strsweep() */
+	char str[4];	/* actually as long as it needs to be */
+} Strnode;
+
+static Strnode **Strtable = NULL;
+static long Strtabsize = 0;
+long Nstrings = 0;		/* number of strings in Strtable */
+long Strbytes = 0;		/* bytes allocated for them */
+long Ntmpstrings = 0;		/* how many of them are from uniqstrtmp() */
+long Strswept = 0;		/* number reclaimed by strsweep() */
+long Nstrsweeps = 0;
+static long Strnewtmp = 0;	/* from uniqstrtmp() since the last sweep */
+static long Strkept = 0;	/* Nstrings after the last sweep */
+
+/* FNV-1a */
+static unsigned int
+strhash(register char *s)
+{
+	register unsigned int h = 2166136261U;
+	register int c;
+
+	while ( (c=(*s++)) != '\0' ) {
+		h ^= (unsigned char)c;
+		h *= 16777619U;
+	}
+	return(h);
+}
 
-/* uniqstr uses the same Hnode definition as is used for array element */
-/* hash tables, even though the only type of value stored is a string. */
+static void
+strgrow(void)
+{
+	Strnode **newtab, *n, *nextn;
+	long newsize, i;
+
+	if ( Strtabsize == 0 ) {
+		char *p = getenv("STRHASHSIZE");
+		long sz = p ? atol(p) : 1024;
+		for ( newsize=64; newsize<sz; newsize*=2 )
+			;
+	}
+	else
+		newsize = Strtabsize * 2;
+	newtab = (Strnode **) kmalloc(newsize*sizeof(Strnode *),"strgrow");
+	for ( i=0; i<newsize; i++ )
+		newtab[i] = NULL;
+	for ( i=0; i<Strtabsize; i++ ) {
+		for ( n=Strtable[i]; n!=NULL; n=nextn ) {
+			nextn = n->next;
+			n->next = newtab[n->hash & (newsize-1)];
+			newtab[n->hash & (newsize-1)] = n;
+		}
+	}
+	if ( Strtable != NULL )
+		kfree(Strtable);
+	Strtable = newtab;
+	Strtabsize = newsize;
+}
+
+/* Return s's Strnode, making one (reclaimable if tmp is set) if needed */
+static Strnode *
+strintern(char *s,int tmp)
+{
+	register Strnode *n;
+	unsigned int h;
+	long leng;
+
+	if ( Strtable == NULL )
+		strgrow();
+	h = strhash(s);
+	for ( n=Strtable[h & (Strtabsize-1)]; n!=NULL; n=n->next ) {
+		if ( n->hash == h && strcmp(n->str,s) == 0 )
+			return(n);
+	}
+	leng = (long)strlen(s);
+	n = (Strnode *) kmalloc((unsigned)(sizeof(Strnode)+leng),"uniqstr");
+	strcpy(n->str,s);
+	n->hash = h;
+	n->tmp = tmp;
+	n->mark = 0;
+	n->next = Strtable[h & (Strtabsize-1)];
+	Strtable[h & (Strtabsize-1)] = n;
+	Nstrings++;
+	Strbytes += (long)sizeof(Strnode) + leng;
+	if ( tmp ) {
+		Ntmpstrings++;
+		/* A sweep looks at every string, so wait until there are */
+		/* as many new ones as were left after the last sweep, */
+		/* and at least Strsweep of them. */
+		if ( ++Strnewtmp >= *Strsweep && Strnewtmp >= Strkept
+			&& *Strsweep > 0 )
+			Chkstuff = 1;
+	}
+	if ( Nstrings > Strtabsize )
+		strgrow();
+	return(n);
+}
 
 Symstr
 uniqstr(char *s)
 {
-	Hnodepp table;
-	Hnodep h, toph;
-	int v;
+	Strnode *n = strintern(s,0);
 
-	if ( Stringtable == NULL ) {
-		char *p = getenv("STRHASHSIZE");
-		Stringtable = newht( p ? atoi(p) : 1009 );
+	if ( n->tmp ) {
+		n->tmp = 0;
+		Ntmpstrings--;
 	}
+	return(n->str);
+}
 
-	{
-		register unsigned int t = 0;
-		register int c;
-		register char *p = s;
+Symstr
+uniqstrtmp(char *s)
+{
+	return(strintern(s,1)->str);
+}
 
-		/* compute hash value of string */
-		while ( (c=(*p++)) != '\0' ) {
-			t += c;
-			t <<= 3;
-		}
-		v = t % (Stringtable->size);
+/*
+ * Strings being built up by "var += str" on a local variable.  Adding
+ * strings normally makes a new one (copying both and interning the
+ * result), so building a long string that way takes time proportional
+ * to the square of its length.  Instead, assign() uses strappend(),
+ * which makes the variable's value a string with room to grow that
+ * isn't in Strtable, and appends to it in place.  That's only safe as
+ * long as the variable is the only thing that refers to it, so it gets
+ * interned by strfinish() as soon as the variable's value is looked at
+ * (see i_lvareval()), and it's thrown away by strdrop() when the
+ * variable goes away or gets a new value.
+ */
+typedef struct Strbuild {
+	Strnode *n;	/* not in Strtable, n->str is the string */
+	long leng;
+	long size;	/* room for the string in n->str */
+} Strbuild;
+
+#define STRBUILDS 8
+static Strbuild Strbuilds[STRBUILDS];
+int Nstrbuilds = 0;	/* entries of Strbuilds that are in use */
+
+static Strbuild *
+findstrbuild(Symstr s)
+{
+	register Strbuild *b;
+
+	for ( b=Strbuilds; b<Strbuilds+STRBUILDS; b++ ) {
+		if ( b->n != NULL && b->n->str == s )
+			return(b);
 	}
+	return(NULL);
+}
+
+static void
+freestrbuild(Strbuild *b)
+{
+	kfree(b->n);
+	b->n = NULL;
+	Nstrbuilds--;
+}
+
+/* Make room in b for leng more characters */
+static void
+growstrbuild(Strbuild *b,long leng)
+{
+	Strnode *n;
+	long size;
 
-	table = Stringtable->nodetable;
-	toph = table[v];
-	if ( toph == NULL ) {
-		/* no collision */
-		h = newhn();
-		h->key.u.str = kmalloc((unsigned)strlen(s)+1,"uniqstr");
+	if ( b->n != NULL && b->leng + leng < b->size )
+		return;
+	for ( size=b->size; size<=b->leng+leng; size*=2 )
+		;
+	n = (Strnode *) kmalloc((unsigned)(sizeof(Strnode)+size),"strappend");
+	n->next = NULL;
+	n->hash = 0;
+	n->tmp = 0;
+	n->mark = 0;
+	if ( b->n != NULL ) {
+		strcpy(n->str,b->n->str);
+		kfree(b->n);
+	}
+	else
+		n->str[0] = '\0';
+	b->n = n;
+	b->size = size;
+}
 
-		strcpy((char*)(h->key.u.str),s);
-		/* h->sym is unused, key and value are the same */
+/*
+ * Return s1+s2, for "var += s2" where s1 is the value of a local
+ * variable.  If s1 is being built (by an earlier strappend()), s2 is
+ * appended to it, and the old pointer is no longer valid.
+ */
+Symstr
+strappend(Symstr s1,Symstr s2)
+{
+	register Strbuild *b = NULL;
+	long leng2 = (long)strlen(s2);
+
+	if ( Nstrbuilds > 0 )
+		b = findstrbuild(s1);
+	if ( b == NULL ) {
+		long leng1 = (long)strlen(s1);
+
+		/* short ones aren't worth it */
+		if ( leng1+leng2 < 64 || Nstrbuilds >= STRBUILDS )
+			return(addstr(s1,s2));
+		for ( b=Strbuilds; b->n!=NULL; b++ )
+			;
+		Nstrbuilds++;
+		b->leng = 0;
+		b->size = 2*(leng1+leng2);
+		growstrbuild(b,leng1);
+		strcpy(b->n->str,s1);
+		b->leng = leng1;
 	}
-	else {
-		Hnodep prev;
+	growstrbuild(b,leng2);
+	strcpy(b->n->str+b->leng,s2);
+	b->leng += leng2;
+	return(b->n->str);
+}
+
+/* If s is being built by strappend(), return it interned (and */
+/* from then on, it's the interned one that has to be used). */
+Symstr
+strfinish(Symstr s)
+{
+	Strbuild *b = findstrbuild(s);
+
+	if ( b == NULL )
+		return(s);
+	s = uniqstrtmp(b->n->str);
+	freestrbuild(b);
+	return(s);
+}
 
-		/* quick test for first node in list, most common case */
-		if ( strcmp(toph->key.u.str,s) == 0  )
-			return(toph->key.u.str);
+/* s is no longer referred to; if it's being built, free it */
+void
+strdrop(Symstr s)
+{
+	Strbuild *b = findstrbuild(s);
+
+	if ( b != NULL )
+		freestrbuild(b);
+}
+
+/* While strsweep() is marking, the reclaimable strings are also in */
+/* Strmarkset, hashed by address, so that a string can be marked */
+/* without looking at it.  Not everything that looks like a string */
+/* is one from uniqstr() (e.g. some filenames in code), and some of */
+/* those may even have been freed. */
+static Strnode **Strmarkset = NULL;
+static long Strmarksize = 0;	/* a power of 2 */
 
-		/* Look through entire list */
-		h = toph;
-		for ( prev=h; (h=h->next) != NULL; prev=h ) {
-			if ( strcmp(h->key.u.str,s) == 0 )
-				break;
+#define strptrhash(s,sz) (((((unsigned long)(intptr_t)(s))>>3)*2654435761UL)&((sz)-1))
+
+static void
+strmarkadd(Strnode *n)
+{
+	register long h = strptrhash(n->str,Strmarksize);
+
+	while ( Strmarkset[h] != NULL )
+		h = (h+1) & (Strmarksize-1);
+	Strmarkset[h] = n;
+}
+
+static void
+strmarkstart(void)
+{
+	register Strnode *n;
+	long i;
+
+	for ( Strmarksize=64; Strmarksize<2*(Ntmpstrings+STRBUILDS); Strmarksize*=2 )
+		;
+	Strmarkset = (Strnode **) kmalloc(Strmarksize*sizeof(Strnode *),"strmarkstart");
+	for ( i=0; i<Strmarksize; i++ )
+		Strmarkset[i] = NULL;
+	for ( i=0; i<Strtabsize; i++ ) {
+		for ( n=Strtable[i]; n!=NULL; n=n->next ) {
+			if ( ! n->tmp )
+				continue;
+			strmarkadd(n);
 		}
-		if ( h == NULL ) {
-			/* string wasn't found, add it */
-			h = newhn();
-			h->key.u.str = kmalloc((unsigned)strlen(s)+1,"uniqstr");
+	}
+	for ( i=0; i<STRBUILDS; i++ ) {
+		if ( Strbuilds[i].n != NULL )
+			strmarkadd(Strbuilds[i].n);
+	}
+}
 
-			strcpy((char*)(h->key.u.str),s);
-			/* h->sym is unused, key and value are the same */
+/* Mark s as being referred to, if it's from uniqstrtmp() */
+static void
+strmark(Symstr s)
+{
+	register Strnode *n;
+	register long h;
+
+	if ( s == NULL || Strmarkset == NULL )
+		return;
+	h = strptrhash(s,Strmarksize);
+	while ( (n=Strmarkset[h]) != NULL ) {
+		if ( n->str == s ) {
+			n->mark = 1;
+			return;
 		}
-		else {
-			/* Symstr found.  Delete it from it's current */
-			/* position so we can move it to the top. */
-			prev->next = h->next;
+		h = (h+1) & (Strmarksize-1);
+	}
+}
+
+static void
+strmarkdatum(Datum d)
+{
+	Datum *dp;
+
+	switch ( d.type ) {
+	case D_STR:
+		strmark(d.u.str);
+		break;
+	case D_DATUM:
+		/* a list from arrlist(), for "for ( k in arr )" */
+		for ( dp=d.u.datum; dp!=NULL && !isnoval(*dp); dp++ )
+			strmarkdatum(*dp);
+		break;
+	}
+}
+
+static void
+strmarktask(Ktaskp t)
+{
+	Datum *dp;
+	Dnode *dn;
+
+	for ( dp=t->stack; dp!=NULL && dp<t->stackp; dp++ )
+		strmarkdatum(*dp);
+	for ( dn=t->onexitargs; dn!=NULL; dn=dn->next )
+		strmarkdatum(dn->d);
+	for ( dn=t->ontaskerrorargs; dn!=NULL; dn=dn->next )
+		strmarkdatum(dn->d);
+	strmark(t->ontaskerrormsg);
+	strmark(t->filename);
+	strmark(t->method);
+}
+
+static int
+strmarkhn(Hnodep h)
+{
+	Symbolp s;
+	Fifodata *fd;
+
+	strmarkdatum(h->key);
+	switch ( h->val.type ) {
+	case D_SYM:
+		if ( (s=h->val.u.sym) == NULL )
+			break;
+		strmarkdatum(s->name);
+		/* local variables are on the task stacks */
+		if ( s->stackpos == 0 )
+			strmarkdatum(s->sd);
+		break;
+	case D_TASK:
+		if ( h->val.u.task != NULL )
+			strmarktask(h->val.u.task);
+		break;
+	case D_FIFO:
+		if ( h->val.u.fifo == NULL )
+			break;
+		for ( fd=h->val.u.fifo->tail; fd!=NULL; fd=fd->next )
+			strmarkdatum(fd->d);
+		break;
+	default:
+		strmarkdatum(h->val);
+		break;
+	}
+	return 0;
+}
+
+/*
+ * Free the strings from uniqstrtmp() that nothing refers to.  Every
+ * symbol, array element, task stack, fifo and note attribute is looked
+ * at (all of which can be found from the hash tables), so this is only
+ * done between instructions, when enough new ones have been made (see
+ * strintern()), or if force is set.  Returns the number freed.
+ */
+long
+strsweep(int force)
+{
+	register Strnode *n, **pn;
+	register Htablep ht;
+	long nfreed = 0, i;
+
+	if ( ! force && ( Strnewtmp < *Strsweep || Strnewtmp < Strkept
+			|| *Strsweep <= 0 ) )
+		return 0;
+	Strnewtmp = 0;
+	if ( Ntmpstrings == 0 && Nstrbuilds == 0 )
+		return 0;
+
+	strmarkstart();
+	for ( ht=Topht; ht!=NULL; ht=ht->h_next )
+		hashvisit(ht,strmarkhn);
+	for ( ht=Htobechecked; ht!=NULL; ht=ht->h_next )
+		hashvisit(ht,strmarkhn);
+	attribvisit(strmark);
+	kfree(Strmarkset);
+	Strmarkset = NULL;
+
+	for ( i=0; i<Strtabsize; i++ ) {
+		pn = &Strtable[i];
+		while ( (n=(*pn)) != NULL ) {
+			if ( n->tmp && ! n->mark ) {
+				*pn = n->next;
+				Nstrings--;
+				Ntmpstrings--;
+				Strbytes -= (long)sizeof(Strnode) + (long)strlen(n->str);
+				kfree(n);
+				nfreed++;
+				continue;
+			}
+			n->mark = 0;
+			pn = &(n->next);
 		}
 	}
-	/* Whether we've just allocated a new node, or whether we've */
-	/* found the node somewhere in the list, we insert it at the */
-	/* top of the list.  Ie. the lists are constantly re-arranging */
-	/* themselves to put the most recently seen entries on top. */
-	h->next = toph;
-	table[v] = h;
-	return(h->key.u.str);
+	/* and any being built for variables that are gone */
+	for ( i=0; i<STRBUILDS; i++ ) {
+		if ( (n=Strbuilds[i].n) == NULL )
+			continue;
+		if ( ! n->mark )
+			freestrbuild(&Strbuilds[i]);
+		else
+			n->mark = 0;
+	}
+	Strswept += nfreed;
+	Nstrsweeps++;
+	Strkept = Nstrings;
+	return nfreed;
+}
+
+/* The number of Strtable chains, how many aren't empty, and the longest */
+void
+strchains(long *nchains,long *nused,long *maxleng)
+{
+	register Strnode *n;
+	long i, leng;
+
+	*nchains = Strtabsize;
+	*nused = 0;
+	*maxleng = 0;
+	for ( i=0; i<Strtabsize; i++ ) {
+		leng = 0;
+		for ( n=Strtable[i]; n!=NULL; n=n->next )
+			leng++;
+		if ( leng > 0 )
+			(*nused)++;
+		if ( leng > *maxleng )
+			*maxleng = leng;
+	}
 }
 
 int
@@ -1572,6 +2097,237 @@ isundefd(Symbolp s)
 		return(0);
 }
 
+/* Sizes that hash tables grow to, each about twice the one before */
+static int Htsizes[] = {
+	61, 127, 251, 503, 1021, 2039, 4093, 8191, 16381, 32749,
+	65521, 131071, 262139, 524287, 1048573, 2097143, 4194301,
+	8388593, 16777213, 33554393, 67108859, 134217689, 268435399,
+	536870909, 0
+};
+
+/* Number of oldslots moved by each change to a table being rehashed. */
+/* It's enough to finish before the new slots fill up. */
+#define HTREHASHSTEP 32
+
+/* The slot that key value k (see Htslot) would start looking at */
+static int
+htstart(long k,int ktype,int size)
+{
+	switch ( ktype ) {
+	case D_NUM:
+		return ((unsigned int)k) % size;
+	case D_STR:
+		return ((unsigned long)k>>2) % size;
+	default:	/* D_OBJ */
+		return ((unsigned int)k>>2) % size;
+	}
+}
+
+/*
+ * Look for key value k in slots, and return its slot, or NULL.
+ * If avail isn't NULL, *avail is set to the first empty or deleted
+ * slot seen, which is where k should go if it's not there.
+ */
+static Htslot *
+htprobe(Htslot *slots,int size,long k,int ktype,Htslot **avail)
+{
+	register Htslot *sl = slots + htstart(k,ktype,size);
+	register Htslot *end = slots + size;
+
+	if ( avail )
+		*avail = NULL;
+	for ( ;; ) {
+		if ( sl->node == NULL ) {
+			if ( avail && *avail == NULL )
+				*avail = sl;
+			return(NULL);
+		}
+		if ( sl->node == HT_DELETED ) {
+			if ( avail && *avail == NULL )
+				*avail = sl;
+		}
+		else if ( sl->k == k && sl->ktype == ktype )
+			return(sl);
+		if ( ++sl == end )
+			sl = slots;
+	}
+}
+
+/* Put an element into a slot found by htprobe() */
+static void
+htput(Htablep ht,Htslot *sl,long k,int ktype,Hnodep h)
+{
+	if ( sl->node == HT_DELETED )
+		ht->ndeleted--;
+	sl->k = k;
+	sl->ktype = ktype;
+	sl->node = h;
+	ht->nused++;
+}
+
+/* Move up to n (or all, if n <= 0) of the oldslots into the slots */
+static void
+htrehash(Htablep ht,int n)
+{
+	register Htslot *sl;
+	Htslot *avail;
+	int all = (n <= 0);
+
+	while ( ht->oldpos < ht->oldsize && (all || n-- > 0) ) {
+		sl = &ht->oldslots[ht->oldpos++];
+		if ( sl->node != NULL && sl->node != HT_DELETED ) {
+			(void) htprobe(ht->slots,ht->size,sl->k,sl->ktype,&avail);
+			htput(ht,avail,sl->k,sl->ktype,sl->node);
+			/* so that looking in oldslots doesn't find it */
+			sl->node = HT_DELETED;
+		}
+	}
+	if ( ht->oldpos >= ht->oldsize ) {
+		kfree(ht->oldslots);
+		ht->oldslots = NULL;
+		ht->oldsize = 0;
+		ht->oldpos = 0;
+	}
+}
+
+/*
+ * Start rehashing ht into new slots, because the current ones are
+ * getting full.  If there are more deleted slots than elements, the
+ * size stays the same.  The elements are moved over a few at a time,
+ * by htrehash().
+ */
+static void
+htgrow(Htablep ht)
+{
+	Htslot *oldslots;
+	int oldsize, oldpos, newsize, i;
+
+	newsize = ht->size;
+	if ( ht->ndeleted <= ht->nused ) {
+		for ( i=0; Htsizes[i]!=0 && Htsizes[i]<=2*ht->size; i++ )
+			;
+		if ( Htsizes[i] != 0 )
+			newsize = Htsizes[i];
+	}
+	if ( ht->oldslots != NULL ) {
+		/* Still rehashing, which only happens if a hashvisit() */
+		/* has held it off, so do it all now. */
+		oldslots = ht->oldslots;
+		oldsize = ht->oldsize;
+		oldpos = ht->oldpos;
+		ht->oldslots = ht->slots;
+		ht->oldsize = ht->size;
+		ht->oldpos = 0;
+		ht->slots = newslots(newsize);
+		ht->size = newsize;
+		ht->nused = 0;
+		ht->ndeleted = 0;
+		htrehash(ht,0);
+		ht->oldslots = oldslots;
+		ht->oldsize = oldsize;
+		ht->oldpos = oldpos;
+		htrehash(ht,0);
+		return;
+	}
+	ht->oldslots = ht->slots;
+	ht->oldsize = ht->size;
+	ht->oldpos = 0;
+	ht->slots = newslots(newsize);
+	ht->size = newsize;
+	ht->nused = 0;
+	ht->ndeleted = 0;
+}
+
+/* Look for key value k in the slots, and then in the oldslots. */
+/* avail is as for htprobe(), and is always in the slots. */
+static Htslot *
+htfind(Htablep ht,long k,int ktype,Htslot **avail)
+{
+	Htslot *sl;
+
+	sl = htprobe(ht->slots,ht->size,k,ktype,avail);
+	if ( sl == NULL && ht->oldslots != NULL )
+		sl = htprobe(ht->oldslots,ht->oldsize,k,ktype,(Htslot**)NULL);
+	return(sl);
+}
+
+/* Changes to a table that's being rehashed move some more */
+/* of it over, unless a hashvisit() is going through it. */
+static void
+htstep(Htablep ht)
+{
+	if ( ht->oldslots != NULL && ht->h_visiting == 0 )
+		htrehash(ht,HTREHASHSTEP);
+}
+
+/* Empty a slot found by htfind(), without freeing its element */
+static void
+htunslot(Htablep ht,Htslot *sl)
+{
+	sl->node = HT_DELETED;
+	if ( sl >= ht->slots && sl < ht->slots+ht->size ) {
+		ht->nused--;
+		ht->ndeleted++;
+	}
+}
+
+/* Add an element whose key value isn't in the table, where */
+/* avail is the slot that htfind() gave for it. */
+static void
+htadd(Htablep ht,Htslot *avail,long k,int ktype,Hnodep h)
+{
+	/* Keep at least a quarter of the slots empty, so probing stays */
+	/* short.  Growing moves the slots, which a hashvisit() can't */
+	/* cope with (see there). */
+	if ( (ht->nused+ht->ndeleted+1)*4 > ht->size*3 ) {
+		if ( ht->h_visiting )
+			execerror("Internal error - hash table added to while it's being visited!?");
+		htgrow(ht);
+		(void) htprobe(ht->slots,ht->size,k,ktype,&avail);
+	}
+	htput(ht,avail,k,ktype,h);
+}
+
+/* Append an element whose key is ndense to the dense elements, */
+/* and then any elements in the slots whose keys now follow on. */
+static void
+htdenseadd(Htablep ht,Hnodep h)
+{
+	Htslot *sl;
+
+	for ( ;; ) {
+		makeroom((long)((ht->ndense+1)*sizeof(Hnodep)),
+			(char**)(&(ht->dense)),&(ht->densesize));
+		ht->dense[ht->ndense++] = h;
+		if ( ht->count == ht->ndense )
+			break;
+		sl = htfind(ht,(long)(ht->ndense),D_NUM,(Htslot**)NULL);
+		if ( sl == NULL )
+			break;
+		h = sl->node;
+		htunslot(ht,sl);
+	}
+}
+
+/* Delete dense element n.  The ones after it aren't contiguous */
+/* any more, so they're moved to the slots. */
+static void
+htdensedelete(Htablep ht,int n)
+{
+	Htslot *avail;
+	int i;
+
+	freehn(ht->dense[n]);
+	ht->count--;
+	htunsort(ht);
+	for ( i=n+1; i<ht->ndense; i++ ) {
+		htstep(ht);
+		(void) htfind(ht,(long)i,D_NUM,&avail);
+		htadd(ht,avail,(long)i,D_NUM,ht->dense[i]);
+	}
+	ht->ndense = n;
+}
+
 /*
  * Look for an element in the hash table.
  * Values of 'action':
@@ -1583,76 +2339,53 @@ isundefd(Symbolp s)
 Hnodep
 hashtable(Htablep ht,Datum key,int action)
 {
-	Hnodepp table;
-	Hnodep h, toph, prev;
-	int v, nc;
-
-	table = ht->nodetable;
+	Htslot *sl, *avail;
+	Hnodep h;
+	long k;
 
 	/* base the hash value on the 'uniqstr'ed pointer */
 	switch ( key.type ) {
 	case D_NUM:
-		v = ((unsigned int)(key.u.val)) % (ht->size);
+		k = key.u.val;
+		/* dense elements are just indexed */
+		if ( k >= 0 && k < ht->ndense ) {
+			if ( action != H_DELETE )
+				return(ht->dense[k]);
+			htdensedelete(ht,(int)k);
+			return(NULL);
+		}
 		break;
 	case D_STR:
-		v = ((intptr_t)(key.u.str)>>2) % (ht->size);
+		k = (long)(intptr_t)(key.u.str);
 		break;
 	case D_OBJ:
-		v = ((unsigned int)(key.u.obj->id)>>2) % (ht->size);
+		k = key.u.obj->id;
 		break;
 	default:
 		execerror("hashtable isn't prepared for that key.type");
 		break;
 	}
 
-	/* look in hash table of existing elements */
-	toph = table[v];
-	if ( toph != NULL ) {
-
-		/* collision */
+	if ( action != H_LOOK )
+		htstep(ht);
 
-		/* quick test for first node in list, most common case */
-		if ( dcompare(key,toph->key) == 0 ) {
-			if ( action != H_DELETE )
-				return(toph);
-			/* delete from list and free */
-			table[v] = toph->next;
-			freehn(toph);
-			ht->count--;
-			return(NULL);
-		}
+	sl = htfind(ht,k,key.type,&avail);
 
-		/* Look through entire list */
-		h = toph;
-		nc = 0;
-		for ( prev=h; ((h=h->next) != NULL); prev=h ) {
-			nc++;
-			if ( dcompare(key,h->key) == 0 ) {
-				break;
-			}
-		}
-		if ( h != NULL ) {
-			/* Found.  Delete it from it's current */
-			/* position so we can either move it to the top, */
-			/* or leave it deleted. */
-			prev->next = h->next;
-			if ( action == H_DELETE ) {
-				/* delete it */
-				freehn(h);
-				ht->count--;
-				return(NULL);
-			}
-			/* move it to the top of the collision list */
-			h->next = toph;
-			table[v] = h;
+	if ( sl != NULL ) {
+		h = sl->node;
+		if ( action != H_DELETE )
 			return(h);
-		}
+		/* delete it and free */
+		htunslot(ht,sl);
+		freehn(h);
+		ht->count--;
+		htunsort(ht);
+		return(NULL);
 	}
 
 	/* it wasn't found */
-	if ( action == H_DELETE ) {
+	if ( action == H_DELETE )
 		return(NULL);
-	}
 
 	if ( action == H_LOOK )
 		return(NULL);
@@ -1661,10 +2394,12 @@ hashtable(Htablep ht,Datum key,int action)
 	h->key = key;
 	h->val = Noval;
 	ht->count++;
+	htunsort(ht);
 
-	/* Add to top of collision list */
-	h->next = toph;
-	table[v] = h;
+	if ( key.type == D_NUM && k == ht->ndense )
+		htdenseadd(ht,h);
+	else
+		htadd(ht,avail,k,key.type,h);
 
 	return(h);
 }
@@ -1724,139 +2459,208 @@ arrsize(Htablep arr)
 	return arr->count;
 }
 
-int
-dtcmp(Datum *d1,Datum *d2)
-{
-	return dcompare(*d1,*d2);
-}
-
-static int elsize;	/* element size */
-static INTFUNC2P qscompare;
-
 /*
- * Quick Sort routine.
- * Code by Duane Morse (...!noao!terak!anasazi!duane)
- * Based on Knuth's ART OF COMPUTER PROGRAMMING, VOL III, pp 114-117.
+ * Sorting of array keys, for arrlist().  Keys are numbers, strings or
+ * objects, and are compared the way dcompare() does it, with the
+ * common cases done here.  It's an introsort - quicksort, with
+ * insertion sort for short ranges and heapsort for when the quicksort
+ * isn't doing well (so it's never worse than n log n).  Mixed number
+ * and string keys don't always compare consistently, so none of the
+ * loops depend on that to stay in bounds.
  */
 
-/* Exchange the contents of two vectors.  n is the size of vectors in bytes. */
-static void
-memexch(register unsigned char *s1,register unsigned char *s2,register int n)
+static int
+keycmp(register Datum *d1,register Datum *d2)
 {
-	register unsigned char c;
-	while (n--) {
-		c = *s1;
-		*s1++ = *s2;
-		*s2++ = c;
+	if ( d1->type == D_NUM && d2->type == D_NUM ) {
+		if ( d1->u.val > d2->u.val )
+			return 1;
+		return ( d1->u.val < d2->u.val ) ? -1 : 0;
+	}
+	if ( d1->type == D_STR && d2->type == D_STR ) {
+		if ( d1->u.str == d2->u.str )
+			return 0;
+		return strcmp(d1->u.str,d2->u.str);
 	}
+	return dcompare(*d1,*d2);
 }
 
+#define KEYSWAP(a,b) { Datum dtmp = (a); (a) = (b); (b) = dtmp; }
+
 static void
-mysort(unsigned char *vec,int nel)
+keysiftdown(Datum *v,long parent,long n)
 {
-	register short i, j;
-	register unsigned char *iptr, *jptr, *kptr;
-
-begin:
-	if (nel == 2) {	/* If 2 items, check them by hand. */
-		if ((*qscompare)(vec, vec + elsize) > 0)
-			memexch(vec, vec + elsize, elsize);
-		return;
-	}
-	j = (short) nel;
-	i = 0;
-	kptr = vec;
-	iptr = vec;
-	jptr = vec + elsize * nel;
-	while (--j > i) {
-
-		/* From the righthand side, find first value */
-		/* that should be to the left of k. */
-		jptr -= elsize;
-		if ((*qscompare)(jptr, kptr) > 0)
-			continue;
-
-		/* Now from the lefthand side, find first value */
-		/* that should be to right of k. */
-
-		iptr += elsize;
-		while(++i < j && (*qscompare)(iptr, kptr) <= 0)
-			iptr += elsize;
+	long child;
+	Datum d;
 
-		if (i >= j)
+	d = v[parent];
+	while ( (child=2*parent+1) < n ) {
+		if ( child+1 < n && keycmp(&v[child+1],&v[child]) > 0 )
+			child++;
+		if ( keycmp(&v[child],&d) <= 0 )
 			break;
-
-		/* Exchange the two items; k will eventually end up between them. */
-		memexch(jptr, iptr, elsize);
+		v[parent] = v[child];
+		parent = child;
 	}
-	/* Move item 0 into position.  */
-	memexch(vec, iptr, elsize);
-	/* Now sort the two partitions. */
-	if ((nel -= (i + 1)) > 1)
-		mysort(iptr + elsize, nel);
+	v[parent] = d;
+}
 
-	/* To save a little time, just start the routine over by hand. */
-	if (i > 1) {
-		nel = i;
-		goto begin;
+static void
+keyheapsort(Datum *v,long n)
+{
+	long i;
+
+	for ( i=n/2-1; i>=0; i-- )
+		keysiftdown(v,i,n);
+	for ( i=n-1; i>0; i-- ) {
+		KEYSWAP(v[0],v[i]);
+		keysiftdown(v,0L,i);
 	}
 }
 
 static void
-pqsort(unsigned char *vec,int nel,int esize,INTFUNC2P compptr)
+keysort(Datum *v,long n,int depth)
 {
-	if (nel < 2)
-		return;
-	elsize = esize;
-	qscompare = compptr;
-	mysort(vec, nel);
+	register long i, j;
+	Datum pivot;
+
+	while ( n > 16 ) {
+		if ( depth-- <= 0 ) {
+			keyheapsort(v,n);
+			return;
+		}
+		/* median of three */
+		i = n / 2;
+		if ( keycmp(&v[i],&v[0]) < 0 )
+			KEYSWAP(v[i],v[0]);
+		if ( keycmp(&v[n-1],&v[i]) < 0 ) {
+			KEYSWAP(v[n-1],v[i]);
+			if ( keycmp(&v[i],&v[0]) < 0 )
+				KEYSWAP(v[i],v[0]);
+		}
+		pivot = v[i];
+		i = 0;
+		j = n - 1;
+		while ( i <= j ) {
+			while ( i < n && keycmp(&v[i],&pivot) < 0 )
+				i++;
+			while ( j >= 0 && keycmp(&v[j],&pivot) > 0 )
+				j--;
+			if ( i <= j ) {
+				KEYSWAP(v[i],v[j]);
+				i++;
+				j--;
+			}
+		}
+		/* v[0..j] and v[i..n-1] are left to do; recurse on */
+		/* the smaller one, so the stack stays shallow */
+		if ( j+1 < n-i ) {
+			keysort(v,j+1,depth);
+			v += i;
+			n -= i;
+		}
+		else {
+			keysort(v+i,n-i,depth);
+			n = j + 1;
+		}
+	}
+	for ( i=1; i<n; i++ ) {
+		pivot = v[i];
+		for ( j=i; j>0 && keycmp(&v[j-1],&pivot) > 0; j-- )
+			v[j] = v[j-1];
+		v[j] = pivot;
+	}
 }
 
-/* Return a Noval-terminated list of the index values of an array.  */
+/* Return a Noval-terminated list of the index values of an array. */
+/* If sortit is set, they're sorted, and the sorted list is kept */
+/* (in h_sorted) until the array's keys change. */
 Datum *
 arrlist(Htablep arr,int *asize,int sortit)
 {
-	register Hnodepp pp;
-	register Hnodep h;
+	register Htslot *sl, *end;
 	register Datum *lp;
-	register int hsize;
+	register int i;
 	Datum *list;
+	int depth, anyobj;
 
-	pp = arr->nodetable;
-	hsize = arr->size;
 	*asize = arrsize(arr);
 	list = (Datum *) kmalloc((*asize+1)*sizeof(Datum),"arrlist");
 
+	if ( sortit && arr->h_sorted != NULL ) {
+		for ( i=0; i<=*asize; i++ )
+			list[i] = arr->h_sorted[i];
+		return(list);
+	}
+
 	lp = list;
+	for ( i=0; i<arr->ndense; i++ )
+		*lp++ = arr->dense[i]->val.u.sym->name;
 	/* visit each slot in the hash table */
-	while ( hsize-- > 0 ) {
-		/* and traverse its list */
-		for ( h=(*pp++); h!=NULL; h=h->next ) {
-			*lp++ = h->val.u.sym->name;
+	end = arr->slots + arr->size;
+	for ( sl=arr->slots; sl!=end; sl++ ) {
+		if ( sl->node != NULL && sl->node != HT_DELETED )
+			*lp++ = sl->node->val.u.sym->name;
+	}
+	if ( arr->oldslots != NULL ) {
+		end = arr->oldslots + arr->oldsize;
+		for ( sl=arr->oldslots+arr->oldpos; sl<end; sl++ ) {
+			if ( sl->node != NULL && sl->node != HT_DELETED )
+				*lp++ = sl->node->val.u.sym->name;
 		}
 	}
 	*lp++ = Noval;
-	if ( sortit )
-		pqsort((unsigned char *)list,*asize,(int)sizeof(Datum),(INTFUNC2P)dtcmp);
+	/* if they're all dense, they're already in order */
+	if ( ! sortit || arr->count == arr->ndense )
+		return(list);
+
+	for ( depth=0,i=*asize; i>1; i/=2 )
+		depth += 2;
+	keysort(list,(long)(*asize),depth);
+
+	/* Objects can be deleted (which changes how they compare) */
+	/* without the array changing, so those aren't kept. */
+	for ( anyobj=0,i=0; i<*asize; i++ ) {
+		if ( list[i].type == D_OBJ ) {
+			anyobj = 1;
+			break;
+		}
+	}
+	if ( ! anyobj ) {
+		arr->h_sorted = (Datum *) kmalloc((*asize+1)*sizeof(Datum),"arrlist");
+		for ( i=0; i<=*asize; i++ )
+			arr->h_sorted[i] = list[i];
+	}
 	return(list);
 }
 
+/* Call f for each element of arr, until it returns non-zero.  The */
+/* table isn't rehashed while this is going on, so f can delete */
+/* elements, but it mustn't add any to arr: that can move the slots, */
+/* and the elements already visited would be visited again. */
 void
 hashvisit(Htablep arr,HNODEFUNC f)
 {
-	register Hnodepp pp;
 	register Hnodep h;
-	register int hsize;
+	register int i;
 
-	pp = arr->nodetable;
-	hsize = arr->size;
+	arr->h_visiting++;
+	for ( i=0; i<arr->ndense; i++ ) {
+		if ( (*f)(arr->dense[i]) )
+			goto out;
+	}
 	/* visit each slot in the hash table */
-	while ( hsize-- > 0 ) {
-		/* and traverse its list */
-		for ( h=(*pp++); h!=NULL; h=h->next ) {
-			if ( (*f)(h) )
-				return;	/* used to be break, apparent mistake */
-		}
+	for ( i=0; i<arr->size; i++ ) {
+		h = arr->slots[i].node;
+		if ( h != NULL && h != HT_DELETED && (*f)(h) )
+			goto out;	/* used to be break, apparent mistake */
+	}
+	for ( i=arr->oldpos; arr->oldslots!=NULL && i<arr->oldsize; i++ ) {
+		h = arr->oldslots[i].node;
+		if ( h != NULL && h != HT_DELETED && (*f)(h) )
+			goto out;
 	}
+    out:
+	arr->h_visiting--;
 }
 
@@ -572,11 +572,24 @@ BYTEFUNC Bytefuncs[] = {
 	i_xy4
 };
 
+/* Do one slice of freeing unused phrases and arrays (see reclaim()), */
+/* keeping track of the longest it takes. */
+static void
+reclaimslice(void)
+{
+	long tm = mdep_milliclock();
+
+	Chkstuff = reclaim(*Reclaimslice);
+	tm = mdep_milliclock() - tm;
+	if ( tm > Reclaimmax )
+		Reclaimmax = tm;
+}
+
 void
 exectasks(int nosetjmp)
 {
 	int wn, b;
-	long tmout, ccnt, thcnt;
+	long tmout, ccnt, thcnt, clk;
 
 #ifdef PYTHON
 	Py_BEGIN_ALLOW_THREADS
@@ -618,15 +631,22 @@ exectasks(int nosetjmp)
 				&& Nsleeptill <= 0 ) {
 				break;	/* quit exectasks */
 			}
-			if ( Topsched!=NULL ) {
+			if ( (clk=nextschedtime()) != MAXCLICKS ) {
 				/* OPTIMIZE!! */
-				tmout = (Topsched->clicks - *Now)*((Tempo/1000)/(*Clicks));
+				tmout = (clk - *Now)*((Tempo/1000)/(*Clicks));
 				tmout -= *Prepoll;
 				if ( tmout < 0 )
 					tmout = 0;
 			}
 			else
 				tmout = *Deftimeout;
+			/* Nothing's running, so it's a good time to free */
+			/* whatever's waiting to be freed. */
+			if ( Chkstuff != 0 ) {
+				reclaimslice();
+				if ( Chkstuff != 0 )
+					tmout = 0;
+			}
 		}
 
 		// if ( tmout == 0 ) {
@@ -635,7 +655,13 @@ exectasks(int nosetjmp)
 
 		// sprintf(Msg1,"TJT DEBUG exectasks before waitfor tmout=%ld",tmout);	
 		// mdep_popup(Msg1);
-		wn = mdep_waitfor((int)tmout);
+		if ( Bouncing && Running == NULL && clk != MAXCLICKS ) {
+			/* Nothing to do until clk, so go straight there */
+			bounceto(clk);
+			wn = K_TIMEOUT;
+		}
+		else
+			wn = mdep_waitfor((int)tmout);
 		// mdep_popup("TJT DEBUG exectasks after waitfor");
 
 		/* Handle MIDI I/O right away. */
@@ -677,9 +703,7 @@ exectasks(int nosetjmp)
 		}
 
 		if ( (Chkstuff!=0) && (ccnt-- <= 0) ) {
-			if ( Tobechecked != NULL ) phcheck();
-			if ( Htobechecked != NULL ) htcheck();
-			Chkstuff = 0;
+			reclaimslice();
 			ccnt = (int)*Checkcount;
 		}
 		// mdep_popup("TJT DEBUG exectasks loop EE");
@@ -782,7 +806,7 @@ void
 i_lvareval(void)
 {
 	Symbolp s;
-	Datum d;
+	Datum d, *dp;
 	int sp;
 
 	s = use_symcode();
@@ -794,13 +818,14 @@ i_lvareval(void)
 
 	if ( sp > 0 ) {
 		/* It's one of the parameter variables */
-		d = ARG(sp - 1);
+		dp = &ARG(sp - 1);
 	}
 	else {
 		/* It's one of the local variables */
-		Datum *dp = T->stackframe - FRAMEHEADER + sp + 1;
-		d = *dp;
+		dp = T->stackframe - FRAMEHEADER + sp + 1;
 	}
+	strfinishd(dp);
+	d = *dp;
 
 	if ( isnoval(d) )
 		execerror("no value for variable \"%s\", \n",symname(s));
@@ -822,6 +847,7 @@ i_gvareval(void)
 			loadsym(s,1);
 		}
 		else {
+			chkrecorded(s);
 			pushexp(s->sd);
 		}
 		break;
@@ -1180,9 +1206,16 @@ i_forin1(void)
 		int asize;
 		Datum *alist;
 
-		alist = arrlist(d.u.arr,&asize,(int)(*Arraysort!=0));
 		pushexp(numdatum(0L));
-		pushexp(datumdatum(alist));
+		if ( d.u.arr->count == d.u.arr->ndense ) {
+			/* All the keys are 0 to n-1, so there's no need */
+			/* for a list of them, just the number of them. */
+			pushexp(numdatum((long)(d.u.arr->ndense)));
+		}
+		else {
+			alist = arrlist(d.u.arr,&asize,(int)(*Arraysort!=0));
+			pushexp(datumdatum(alist));
+		}
 	}
 	else
 		execerror("'for(var in expr)' only works on phrases and arrays!");
@@ -1208,16 +1241,35 @@ i_forin2(void)
 		execerror("IFORIN2 didn't get symbol!?");
 	if ( d.type == D_PHR ) {
 		Noteptr nt;
-		Phrasep ph;
+		Phrasep ph = NULL;
+		Symbolp s = d3.u.sym;
 		if ( d2.u.note == NULL ) {
 			forinjumptoend();
 			return;
 		}
-		clearsym(d3.u.sym);
-		phrvarinit(d3.u.sym);	/* new phrase */
-		nt = ntcopy(d2.u.note);
-		ph = symdataptr(d3.u.sym)->u.phr;
-		ntinsert(nt,ph);
+		/* If the variable still has a single-note phrase (normally */
+		/* the one from the last time around) that nothing else */
+		/* is using, its note is re-used, rather than making a new */
+		/* phrase and note for every time around the loop. */
+		if ( s->stype == VAR && symdataptr(s)->type == D_PHR ) {
+			ph = symdataptr(s)->u.phr;
+			if ( ph == NULL || ph == d.u.phr || phreallyused(ph) != 1
+				|| firstnote(ph) == NULL
+				|| nextnote(firstnote(ph)) != NULL )
+				ph = NULL;
+		}
+		if ( ph != NULL ) {
+			nt = firstnote(ph);
+			ntreplace(nt,d2.u.note);
+			phchanged(ph);
+		}
+		else {
+			clearsym(s);
+			phrvarinit(s);	/* new phrase */
+			nt = ntcopy(d2.u.note);
+			ph = symdataptr(s)->u.phr;
+			ntinsert(nt,ph);
+		}
 		ph->p_leng = endof(nt);
 		(Stackp-3)->u.note = nextnote(d2.u.note);
 	}
@@ -1236,6 +1288,19 @@ i_forin2(void)
 		*symdataptr(d3.u.sym) = subd;
 		(Stackp-3)->u.val = v1 + 1;
 	}
+	else if ( d.type == D_NUM ) {
+		long v1;
+
+		v1 = d2.u.val;
+		if ( v1 >= d.u.val ) {
+			forinjumptoend();
+			return;
+		}
+		clearsym(d3.u.sym);
+		d3.u.sym->stype = VAR;
+		*symdataptr(d3.u.sym) = numdatum(v1);
+		(Stackp-3)->u.val = v1 + 1;
+	}
 	else
 		execerror("IFORIN2 got unexpected type!?");
 }
@@ -1342,6 +1407,7 @@ i_select2(void)
 		return;
 	}
 	qph = (Stackp-2)->u.phr;
+	phchanged(qph);
 	if ( firstnote(qph) )
 		ntfree(firstnote(qph));
 	setfirstnote(qph) = ntcopy(wnt);
@@ -2261,6 +2327,8 @@ newtp(int state)
 	t->ontaskerrorargs = NULL;
 	t->ontaskerrormsg = NULL;
 	t->qmarkframe = NULL;
+	t->schedlist = NULL;
+	t->noteoffs = -1;
 	t->linenum = 0;
 	t->filename = "";
 	t->tid = Tid++;
@@ -15,13 +15,9 @@ int Chkstuff = 0;
 void
 addtobechecked(register Phrasep p)
 {
-	register Phrasep tp;
-
 	/* make sure it's not already in there */
-	for ( tp=Tobechecked; tp!=NULL; tp=tp->p_next ) {
-		if ( tp == p )
-			return;
-	}
+	if ( p->p_state == PH_TOBECHECKED )
+		return;
 
 	/* Workaround to detect a bug. */
 	if ( p->p_tobe < -1000 ) {
@@ -40,6 +36,7 @@ addtobechecked(register Phrasep p)
 
 	p->p_next = Tobechecked;
 	p->p_prev = NULL;
+	p->p_state = PH_TOBECHECKED;
 	if ( Tobechecked != NULL )
 		Tobechecked->p_prev = p;
 	Tobechecked = p;
@@ -75,6 +72,44 @@ httobechecked(register Htablep p)
  * by 'offset'. The assumption is that both phrase's are already sorted.
  */
 
+/*
+ * phdouble(p)
+ *
+ * Merge p with itself, in place.  Each run of notes that compare
+ * equal gets a copy of itself in front of it, which is where merging
+ * p with a copy of itself would put them.
+ */
+
+static void
+phdouble(Phrasep p)
+{
+	Noteptr run, nt, cp, cpfirst, cplast, last, prev;
+
+	phchanged(p);
+	prev = NULL;
+	run = firstnote(p);
+	while ( run != NULL ) {
+		chkrealoften();
+		cpfirst = cplast = last = NULL;
+		for ( nt=run; nt!=NULL && ntcmporder(run,nt)==0; nt=nextnote(nt) ) {
+			cp = ntcopy(nt);
+			if ( cplast == NULL )
+				cpfirst = cp;
+			else
+				cplast->next = cp;
+			cplast = cp;
+			last = nt;
+		}
+		cplast->next = run;
+		if ( prev == NULL )
+			setfirstnote(p) = cpfirst;
+		else
+			prev->next = cpfirst;
+		prev = last;
+		run = nt;
+	}
+}
+
 void
 phrmerge(Phrasep p,Phrasep outp,long offset)
 {
@@ -85,6 +120,12 @@ phrmerge(Phrasep p,Phrasep outp,long offset)
 	Noteptr lastn;
 	int newone = 0;
 
+	/* "ph |= ph" doesn't need a copy of ph */
+	if ( p == outp && offset == 0 ) {
+		phdouble(p);
+		return;
+	}
+
 	/* If p and outp are same, create fresh copy (easiest fix) */
 	if ( p == outp ) {
 		Phrasep np = newph(1);
@@ -99,6 +140,7 @@ phrmerge(Phrasep p,Phrasep outp,long offset)
 	if ( firstnote(p)!=NULL && firstnote(outp)!=NULL
 		&& (lastn=lastnote(outp))!=NULL 
 		&& ntcmporder(lastnote(outp),firstnote(p)) < 0 ) {
+		phgrown(outp);
 		for ( nt=firstnote(p); nt!=NULL; nt=nextnote(nt) ) {
 			nt2 = ntcopy(nt);
 			timeof(nt2) += offset;
@@ -110,10 +152,21 @@ phrmerge(Phrasep p,Phrasep outp,long offset)
 		goto getout;
 	}
 
+	/* A single note (as in "r |= nt") can just be inserted, */
+	/* which is cheap if it goes near the last one inserted, */
+	/* rather than merging the whole of outp. */
+	if ( firstnote(p)!=NULL && nextnote(firstnote(p))==NULL ) {
+		nt2 = ntcopy(firstnote(p));
+		timeof(nt2) += offset;
+		ntinsertbefore(nt2,outp);
+		goto getout;
+	}
+
 	/* We want to merge outp and p, putting the result */
 	/* back into outp.  Pull off the existing outp list */
 	/* and zero it out. */
 
+	phchanged(outp);
 	outn = firstnote(outp);
 	setfirstnote(outp) = NULL;
 	nt = firstnote(p);
@@ -200,16 +253,35 @@ ph1dump(Phrasep p)
 		(KEY_PRIdTYPE)p,num,(int)(p->p_used),(int)(p->p_tobe));tprint(Msg1);
 }
 
+/*
+ * Notes of phrases that phcheck() has found to be unused, and arrays
+ * that htcheck() has found to be unused, aren't freed right away.
+ * Instead, they're queued up here and freed by reclaim(), a slice at a
+ * time, so that throwing away a huge phrase or array doesn't hold up
+ * the tasks and the MIDI output.
+ */
+static Noteptr *Freechains = NULL;	/* lists of notes waiting to be freed */
+static long Nfreechains = 0;
+static long Szfreechains = 0;		/* size of Freechains, in bytes */
+static Noteptr Freecurr = NULL;		/* the list being freed */
+static Htablep Htfreeing = NULL;	/* arrays waiting to be cleared */
+static int Htfreepos = 0;		/* next bucket to clear in Htfreeing */
+
+long Reclaimed = 0;	/* notes and array elements freed by reclaim() */
+long Reclaimmax = 0;	/* longest time (ms) taken by a slice of checking */
+
 void
 phcheck(void)
 {
 	register Phrasep p, nxt;
+	Noteptr fn;
 
 	dummyset(nxt);
 	for ( p=Tobechecked; p!=NULL; p=nxt ) {
 
 		p->p_used += p->p_tobe;
 		p->p_tobe = 0;
+		p->p_state = 0;
 
 		nxt = p->p_next;
 
@@ -230,9 +302,12 @@ phcheck(void)
 			keyerrfile("phcheck is tossing phrase with negative used value (%d)!\n",p->p_used);
 		}
 		else {
-			Noteptr fn = realfirstnote(p);
-			if ( fn )
-				freents(fn);
+			fn = realfirstnote(p);
+			if ( fn ) {
+				/* the notes get freed by reclaim() */
+				makeroom((long)((Nfreechains+1)*sizeof(Noteptr)),(char**)(&Freechains),&Szfreechains);
+				Freechains[Nfreechains++] = fn;
+			}
 			reinitph(p);
 			/* and add it to free list */
 			p->p_next = Freeph;
@@ -272,11 +347,11 @@ if(*Debug>1)eprint("SUMMED h=%lld used=%d\n",(intptr_t)h,h->h_used);
 			h->h_prev->h_next = h->h_next;
 		if ( h->h_next != NULL )
 			h->h_next->h_prev = h->h_prev;
-		h->h_state = 0;
 
 		if ( h->h_used > 0 ) {
 if(*Debug>1)eprint("htcheck, h=%lld still used\n",(intptr_t)h);
 			/* and add it back to Topht list */
+			h->h_state = 0;
 			h->h_next = Topht;
 			h->h_prev = NULL;
 			if ( Topht != NULL )
@@ -286,14 +361,91 @@ if(*Debug>1)eprint("htcheck, h=%lld still used\n",(intptr_t)h);
 			/* There's a but somewhere - occasionally, an h */
 			/* gets into the Htobechecked list that is bogus. */
 			tprint("h_used < 0, not freeing h\n");
-			break;
-		} else {
+			continue;	/* but don't lose the rest of the list */
+		} else if ( h->count == 0 ) {
 if(*Debug>1)eprint("htcheck calling freeht on %lld used=%d tobe=%d\n",(intptr_t)h,h->h_used,h->h_tobe);
 			freeht(h);
+		} else {
+			/* its elements get freed by reclaim() */
+			h->h_state = HT_TOFREE;
+			h->h_next = Htfreeing;
+			h->h_prev = NULL;
+			Htfreeing = h;
 		}
 	}
 }
 
+/*
+ * reclaimnotes(budget)
+ *
+ * Free up to budget of the notes that phcheck() has queued up, or all
+ * of them if budget <= 0.  Returns the number freed.
+ */
+long
+reclaimnotes(long budget)
+{
+	register Noteptr n;
+	long nfreed = 0;
+
+	while ( Freecurr != NULL || Nfreechains > 0 ) {
+		if ( Freecurr == NULL )
+			Freecurr = Freechains[--Nfreechains];
+		while ( Freecurr != NULL ) {
+			if ( budget > 0 && nfreed >= budget )
+				goto out;
+			n = Freecurr;
+			Freecurr = nextnote(n);
+			ntfree(n);
+			nfreed++;
+		}
+	}
+    out:
+	Reclaimed += nfreed;
+	return nfreed;
+}
+
+/*
+ * reclaim(budget)
+ *
+ * Check the phrases and arrays that might be unused, and free up to
+ * budget of the notes and array elements that are queued up, or all
+ * of them if budget <= 0.  Freeing array elements can make more
+ * phrases and arrays unused, so they're checked again as it goes.
+ * Returns non-zero if there's more to be done.
+ */
+int
+reclaim(long budget)
+{
+	register Htablep h;
+	long nfreed = 0, n;
+
+	/* unused strings, if it's time (see strsweep()) */
+	(void) strsweep(0);
+
+	for ( ;; ) {
+		if ( Tobechecked != NULL )
+			phcheck();
+		if ( Htobechecked != NULL )
+			htcheck();
+		nfreed += reclaimnotes(budget>0 ? budget-nfreed : 0L);
+		if ( budget > 0 && nfreed >= budget )
+			break;
+		if ( (h=Htfreeing) == NULL )
+			break;
+		n = clearhtsome(h,budget>0 ? budget-nfreed : 0L,&Htfreepos);
+		nfreed += n;
+		Reclaimed += n;
+		if ( Htfreepos < h->size || h->oldslots != NULL )
+			break;	/* budget used up */
+		Htfreeing = h->h_next;
+		Htfreepos = 0;
+		h->count = 0;
+		freeht(h);
+	}
+	return ( Freecurr != NULL || Nfreechains > 0 || Htfreeing != NULL
+		|| Tobechecked != NULL || Htobechecked != NULL );
+}
+
 /* This sequence number is used to represent a pseudo-modification-time */
 /* in phrases.  Cheaper than mdep_currtime(), and monotonically increasing. */
 /* Macros usesequence() and currsequence() are defined in key.h */
@@ -567,19 +719,77 @@ nttostr(Noteptr n,char *buff)
 	*p = '\0';
 }
 
+/*
+ * phstats
+ *
+ * Return the aggregate values (number of notes, sums of their values,
+ * and limits) of a phrase.  They're computed the first time they're
+ * needed, and kept until the phrase changes (see phgrown()).
+ */
+
+Phstats *
+phstats(Phrasep p)
+{
+	register Noteptr n;
+	register Phstats *st = &(p->p_stats);
+	Unchar* b0;
+	long tm;
+	int y1, y2;
+
+	if ( p->p_statsok )
+		return st;
+	st->nall = st->nnotes = 0;
+	st->sumpitch = st->sumvol = st->sumdur = 0;
+	st->sumtime = st->sumchan = st->sumport = st->sumflags = 0;
+	st->lowest = 128;
+	st->highest = -1;
+	st->earliest = MAXCLICKS;
+	st->latest = -MAXCLICKS;
+	for ( n=firstnote(p); n!=NULL; n=nextnote(n) ) {
+		st->nall++;
+		st->sumtime += timeof(n);
+		st->sumport += portof(n);
+		st->sumflags += flagsof(n);
+		if ( ntisnote(n) ) {
+			st->nnotes++;
+			st->sumpitch += pitchof(n);
+			st->sumvol += volof(n);
+			st->sumdur += durof(n);
+			st->sumchan += 1 + chanof(n);
+			y1 = y2 = pitchof(n);
+		}
+		else {
+			/* same as ntdotvalue(), which gives -1 when */
+			/* there's no status byte */
+			if ( (b0=ptrtobyte(n,0))!=NULL && ((*b0)&0x80) != 0 )
+				st->sumchan += 1+(int)((*b0)&0xf);
+			else
+				st->sumchan += -1;
+			nonnotesize(n,&y1,&y2);
+		}
+		if ( y2 > st->highest )
+			st->highest = y2;
+		if ( y1 < st->lowest )
+			st->lowest = y1;
+		if ( timeof(n) < st->earliest )
+			st->earliest = timeof(n);
+		tm = endof(n);
+		if ( tm > st->latest )
+			st->latest = tm;
+	}
+	p->p_statsok = 1;
+	return st;
+}
+
 int
 phsize(register Phrasep p,register int notes)
 {
-	register int size = 0;
-	register Noteptr n;
+	Phstats *st;
 
 	if ( p==NULL )
 		return(0);
-	for ( n=firstnote(p); n!=NULL; n=nextnote(n) ) {
-		if ( notes==0 || ntisnote(n) )
-			size++;
-	}
-	return(size);
+	st = phstats(p);
+	return (int)(notes ? st->nnotes : st->nall);
 }
 
 /*
@@ -593,6 +803,7 @@ picknt(register Phrasep ph,register int picknum)
 {
 	register Noteptr nt;
 	register int n;
+	Ntindex *ix;
 
 	if ( picknum < PHRASEBASE ) {
 #ifdef BASEERROR
@@ -601,6 +812,12 @@ picknt(register Phrasep ph,register int picknum)
 		return(NULL);
 #endif
 	}
+	/* Notes near the start aren't worth building an index for */
+	n = picknum - PHRASEBASE;
+	if ( ph->p_index != NULL || n >= *Phindexmin ) {
+		if ( (ix=phindex(ph)) != NULL )
+			return (n < ph->p_nindex) ? ix[n].nt : NULL;
+	}
 	for ( n=PHRASEBASE,nt=firstnote(ph); nt!=NULL; nt=nextnote(nt) ){
 		if ( n++ >= picknum )
 			break;
@@ -695,6 +912,7 @@ phdotvalue(Phrasep ph,int type)
 {
 	Datum d;
 	Noteptr nt;
+	Phstats *st;
 	int n=0;
 	long sum=0;
 
@@ -728,13 +946,17 @@ phdotvalue(Phrasep ph,int type)
 	case PORT:
 		/* The dot value of the rest (PITCH, VOL, etc.) is the */
 		/* average over the notes in the phrase.  */
-		for ( nt=firstnote(ph); nt!=NULL; nt=nextnote(nt) ) {
-			/* non-notes are only included in TIME/CHAN/FLAGS values */
-			if ( ntisnote(nt) || (type==TIME || type==CHAN || type==PORT || type==FLAGS) ) {
-				(void) ntdotvalue(nt,type,&d);
-				sum += numval(d);
-				n++;
-			}
+		/* non-notes are only included in TIME/CHAN/PORT/FLAGS values */
+		st = phstats(ph);
+		n = (int)st->nall;
+		switch (type) {
+		case PITCH: sum = st->sumpitch; n = (int)st->nnotes; break;
+		case VOL: sum = st->sumvol; n = (int)st->nnotes; break;
+		case DUR: sum = st->sumdur; n = (int)st->nnotes; break;
+		case TIME: sum = st->sumtime; break;
+		case CHAN: sum = st->sumchan; break;
+		case FLAGS: sum = st->sumflags; break;
+		case PORT: sum = st->sumport; break;
 		}
 		d = numdatum( (n==0) ? 0L : (long)(sum/n) );
 		break;
@@ -1189,7 +1411,7 @@ newlk(Symstr nm)
 	used++;
 	lk = lastlk++;
    getout:
-	lk->name = nm;
+	lk->name = uniqstr(nm);	/* so strsweep() won't free it */
 	lk->owner = NULL;
 	lk->next = NULL;
 	lk->notify = NULL;